@@ -6,16 +6,48 @@
  * of the alignment; a user may want to allocate an object aligned to the cache
  * boundary (which is 64 or 128 bytes on modern systems). */
 
+/* For MAP_ANONYMOUS, which glibc hides in strict ISO C modes. */
+#if defined(ARENA_GUARD) && defined(__linux__) && !defined(_DEFAULT_SOURCE)
+    #define _DEFAULT_SOURCE
+#endif
+
 #include "arena.h"
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdarg.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <stdio.h>
 
 /* *INDENT-OFF* */
+/* The registry reports the peak usage of each arena, which is only tracked 
+ * with the statistics. */
+#if defined(ARENA_REGISTRY) && !defined(ARENA_STATS)
+    #define ARENA_STATS
+#endif
+
+#if defined(ARENA_REGISTRY) || defined(ARENA_TRACE) || defined(ARENA_CANARY)
+    #include <stdatomic.h>
+#endif
+
+#ifdef ARENA_TRACE
+    #include <time.h>
+#endif
+
+#ifdef ARENA_GUARD
+    #if defined(_WIN32)
+        #include <windows.h>
+    #elif defined(__unix__) || defined(__APPLE__)
+        #include <sys/mman.h>
+        #include <unistd.h>
+    #else
+        #error "ARENA_GUARD requires mmap() or VirtualAlloc()."
+    #endif
+#endif
+
 /* In C2X/C23 or later, nullptr is a keyword. */
 /* Patch up C18 (__STDC_VERSION__ == 201710L) and earlier versions.  */
 #if !defined(__STDC_VERSION__) || __STDC_VERSION__ <= 201710L
@@ -24,29 +56,302 @@
 
 #define INITIAL_MPOOL_COUNT  2
 
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+    #define ALIGNOF(type)    _Alignof(type)
+#else
+    #define ALIGNOF(type)    offsetof(struct { char c; type t; }, t)
+#endif
+
+#define VEC_MIN_CAP          8
+
+#define DEQUE_CHUNK_SIZE     4096
+#define DEQUE_MIN_MAP_CAP    8
+
+/* Open-addressing tables store a control byte per slot, and probe them a group
+ * at a time, with SSE2 or NEON where available, and SWAR (SIMD within a 
+ * register) elsewhere. A control byte is either CTRL_EMPTY, CTRL_DELETED, or 
+ * the top 7 bits of the hash of the key in the slot. */
+#if defined(__SSE2__) || defined(_M_X64) \
+    || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define GROUP_SSE2
+    #define GROUP_WIDTH      16
+#elif defined(__ARM_NEON) && defined(__aarch64__) \
+    && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    #include <arm_neon.h>
+    #define GROUP_NEON
+    #define GROUP_WIDTH      8
+#else
+    #define GROUP_WIDTH      8
+#endif
+
+#define CTRL_EMPTY           0x80
+#define CTRL_DELETED         0xFE
+#define TABLE_MIN_CAP        16
+
+#define PROFILE_MIN_CAP      64
+
+#define REGISTRY_NAME_MAX    64
+#define CAPACITY_SLACK_SHIFT 1      /* Learned capacities get 1/2 more. */
+
+/* The tails of the pools before the current one are indexed by size, in 
+ * buckets of powers of 2 from 2^LEFTOVER_MIN_SHIFT bytes, the last of which 
+ * also holds all the larger ones. Smaller tails are not worth a look. */
+#define LEFTOVER_BUCKETS     16
+#define LEFTOVER_MIN_SHIFT   6
+
+/* Debug builds without a sanitizer check this many bytes past the last block of
+ * each pool on reset and destroy. */
+#define TAIL_CHECK_SIZE      16
+
+#ifdef ARENA_CANARY
+    #define CANARY_SIZE      8
+    #define CANARY_MIN_CAP   64
+#else
+    #define CANARY_SIZE      0
+#endif
+
+/* A trace starts with the magic, followed by the events, each a byte holding 
+ * the operation, and the failure flag in its top bit, then the nanoseconds 
+ * since the start of the trace, the id of the arena, and the arguments of 
+ * the operation, all as LEB128 varints. */
+#define TRACE_MAGIC          "ARENATR\1"
+#define TRACE_MAGIC_LEN      8
+#define TRACE_FAILED         0x80
+#define TRACE_RECORD_MAX     64
+
 #ifdef DEBUG
-    #include <string.h>
     #define D(x) x
 #else
     #define D(x) (void) 0
 #endif
+
+/* Debug builds poison the bytes of a pool that are not handed out under 
+ * AddressSanitizer, and describe the blocks to Valgrind where its headers are
+ * available. */
+#ifdef DEBUG
+    #if defined(__SANITIZE_ADDRESS__)
+        #define HAVE_ASAN
+    #elif defined(__has_feature)
+        #if __has_feature(address_sanitizer)
+            #define HAVE_ASAN
+        #endif
+    #endif
+
+    #if defined(__has_include)
+        #if __has_include(<valgrind/memcheck.h>)
+            #define HAVE_VALGRIND
+        #endif
+    #endif
+#endif
+
+#ifdef HAVE_ASAN
+    #include <sanitizer/asan_interface.h>
+    #define POISON(p, n)    ASAN_POISON_MEMORY_REGION((p), (n))
+    #define UNPOISON(p, n)  ASAN_UNPOISON_MEMORY_REGION((p), (n))
+#else
+    #define POISON(p, n)    ((void) (p), (void) (n))
+    #define UNPOISON(p, n)  ((void) (p), (void) (n))
+#endif
+
+#ifdef HAVE_VALGRIND
+    #include <valgrind/memcheck.h>
+    #define VG(x) x
+#else
+    #define VG(x) (void) 0
+#endif
+
+#ifdef ARENA_STATS
+    #define STATS(x) x
+#else
+    #define STATS(x) (void) 0
+#endif
+
+#ifdef ARENA_TRACE
+    #define TRACE(x) x
+#else
+    #define TRACE(x) (void) 0
+#endif
+
+#ifdef ARENA_REGISTRY
+    #define REGISTRY(x) x
+#else
+    #define REGISTRY(x) (void) 0
+#endif
+
+/* Static probes for DTrace, SystemTap and bpftrace, under the `arena` provider.
+ * They compile to a nop each, and cost nothing unless a tracer attaches to 
+ * them. All take the arena as their first argument:
+ *
+ *      pool__new(arena, capacity, pools)       A pool was added.
+ *      alloc__fail(arena, alignment, size, pools)
+ *                                              The last pool was too full.
+ *      large__alloc(arena, alignment, size)    A block was given its own 
+ *                                              buffer.
+ *      realloc__fail(arena, size, pools)       Likewise, to expand.
+ *      reset(arena, used, pools)               Before the arena is reset.
+ *      destroy(arena, reserved, pools)         Before it is destroyed. */
+#ifdef ARENA_USDT
+    #if defined(__has_include)
+        #if !__has_include(<sys/sdt.h>)
+            #error "ARENA_USDT requires <sys/sdt.h>, e.g. from systemtap-sdt-dev"
+        #endif
+    #endif
+    #include <sys/sdt.h>
+    #define PROBE3(name, a, b, c)       DTRACE_PROBE3(arena, name, a, b, c)
+    #define PROBE4(name, a, b, c, d)    DTRACE_PROBE4(arena, name, a, b, c, d)
+#else
+    #define PROBE3(name, a, b, c)       (void) 0
+    #define PROBE4(name, a, b, c, d)    (void) 0
+#endif
 /* *INDENT-ON* */
 
 typedef struct pool {
     size_t offset;
     size_t buf_len;
+    size_t padding;
+    size_t top;                 /* Bytes handed out from the end, downwards, 
+                                   by arena_alloc_top(). */
+    size_t top_padding;
     bool is_heap_alloc;
     uint8_t *buf;
+    struct pool *next_leftover;
+    struct pool *next_top;
 } M_Pool;
 
+/* A block too large for the pools, allocated on its own and kept on a list so
+ * that it is freed with them. It does not live in `pools`, as adding one could
+ * move the arena. */
+typedef struct large {
+    struct large *next;
+    size_t len;                 /* Bytes allocated, alignment slack included. */
+    uint8_t *buf;
+} Large;
+
 struct arena {
     size_t count;
     size_t capacity;
     size_t current;
     size_t last_alloc_size;
+    size_t reserved;
+    size_t used;
+    size_t large_threshold;
+    ArenaAllocator allocator;
+    Arena *parent;              /* Set for an arena made by arena_new_child(),
+                                   which follows the parent as it moves. */
+    Arena *first_child;
+    Arena *next_sibling;
+    bool last_is_large;
+    Large *large;
+    size_t large_used;          /* The bytes of `used` in large blocks. */
+    M_Pool *last_leftover;      /* Where the last allocation was made, if it 
+                                   was not the current pool. */
+    M_Pool *leftovers[LEFTOVER_BUCKETS];
+    M_Pool *tops;               /* The pools with a non-zero `top`, linked 
+                                   through `next_top`. */
+#ifdef ARENA_STATS
+    ArenaStats stats;
+#endif
+#ifdef ARENA_PROFILE
+    struct profile *profile;
+#endif
+#ifdef ARENA_REGISTRY
+    struct registry_entry *entry;
+    size_t pool_peak;           /* The highest `used` less `large_used`, which
+                                   is what the pools had to hold. */
+#endif
+#ifdef ARENA_TRACE
+    uint64_t trace_id;
+#endif
+#ifdef ARENA_CANARY
+    uint64_t canary;
+    size_t canary_count;
+    size_t canary_cap;
+    uint8_t **canaries;
+#endif
     M_Pool *pools[];
 };
 
+#ifdef ARENA_PROFILE
+/* The bytes and allocations attributed to a call site. */
+typedef struct site {
+    const char *name;
+    size_t count;
+    size_t bytes;
+} Site;
+
+/* An open-addressing table of call sites, keyed by the address of their name,
+ * which is normally a string literal. Equal names at different addresses are
+ * merged when the report is made. It is allocated with malloc() rather than 
+ * from the arena, so that profiling does not change what it measures. */
+typedef struct profile {
+    size_t count;
+    size_t cap;
+    size_t lost;
+    FILE *on_destroy;
+    Site sites[];
+} Profile;
+#endif
+
+#ifdef ARENA_REGISTRY
+/* An entry of the process-wide list of named arenas. Entries are pushed at the
+ * head and never unlinked or freed, so that the list can be walked without 
+ * locks. When an arena is destroyed, its entry is released, and claimed by the
+ * next arena of the same name, so that the name never changes once the entry
+ * is pushed.
+ *
+ * The arena itself may be moved or freed by its owner at any time, so dumps
+ * read a snapshot of its metrics, which the owner publishes in the entry. */
+typedef struct registry_entry {
+    atomic_bool in_use;
+    char name[REGISTRY_NAME_MAX];
+    _Atomic size_t pools;
+    _Atomic size_t reserved;
+    _Atomic size_t used;
+    _Atomic size_t peak;
+    _Atomic size_t pool_peak;   /* The peak of `used` less large blocks. */
+    struct registry_entry *next;
+} Registry_Entry;
+
+static _Atomic (Registry_Entry *) registry;
+
+/* The capacity learned for a name: `loaded` from a file written by an earlier
+ * run, which arenas of that name are created with, and `peak`, the highest
+ * usage of one in this run. Pushed like the registry entries, and never 
+ * freed. */
+typedef struct capacity_hint {
+    char name[REGISTRY_NAME_MAX];
+    _Atomic size_t loaded;
+    _Atomic size_t peak;
+    struct capacity_hint *next;
+} Capacity_Hint;
+
+static _Atomic (Capacity_Hint *) capacity_hints;
+static char *capacity_path;
+#endif
+
+#ifdef ARENA_TRACE
+static _Atomic (FILE *) trace_stream;
+/* In nanoseconds, set before the stream is published. */
+static _Atomic int64_t trace_epoch;
+static _Atomic uint64_t trace_last_id;
+#endif
+
+/* The number of arguments recorded for each operation. */
+static const unsigned char trace_nargs[] = {
+    [ARENA_TRACE_NEW] = 2,
+    [ARENA_TRACE_ALLOC] = 2,
+    [ARENA_TRACE_ALLOCARRAY] = 3,
+    [ARENA_TRACE_REALLOC] = 1,
+    [ARENA_TRACE_RESIZE] = 2,
+    [ARENA_TRACE_RESET] = 0,
+    [ARENA_TRACE_DESTROY] = 0,
+    [ARENA_TRACE_ALLOC_TOP] = 2,
+    [ARENA_TRACE_RESET_TOP] = 0,
+    [ARENA_TRACE_SET_LARGE_THRESHOLD] = 1,
+    [ARENA_TRACE_RESET_CONSOLIDATE] = 1,
+};
+
 ATTRIB_INLINE ATTRIB_CONST static inline bool is_power_of_two(uintptr_t x)
 {
     return (x & (x - 1)) == 0;
@@ -57,235 +362,3487 @@ ATTRIB_INLINE ATTRIB_CONST static inline bool is_multiple_of(size_t a, size_t b)
     return a % b == 0;
 }
 
-size_t arena_pool_capacity(Arena *arena)
+ATTRIB_INLINE ATTRIB_CONST static inline size_t round_up(size_t n, 
+                                                         size_t alignment)
 {
-    const M_Pool *const curr_pool = arena->pools[arena->current - 1];
+    return (n + alignment - 1) & ~(alignment - 1);
+}
 
-    return curr_pool->buf_len - curr_pool->offset;
+/* Returns the number of bytes free between the two ends of `pool`. */
+ATTRIB_INLINE ATTRIB_PURE static inline size_t pool_room(const M_Pool *pool)
+{
+    return pool->buf_len - pool->top - pool->offset;
 }
 
-size_t arena_allocated_bytes(Arena *arena)
+/* Returns the number of bytes to leave for a canary before the next block in 
+ * `pool`. A canary guards the block before it, so the first block of a pool 
+ * needs none. */
+ATTRIB_INLINE static inline size_t canary_lead(const M_Pool *pool)
 {
-    size_t sum = 0;
+    return pool->offset != 0 ? CANARY_SIZE : 0;
+}
 
-    for (size_t i = 0; i < arena->count; ++i) {
-        sum += arena->pools[i]->buf_len;
+/* Returns the bucket of the leftover index that holds tails of `n` bytes, 
+ * `n` being at least 2^LEFTOVER_MIN_SHIFT. */
+ATTRIB_INLINE ATTRIB_CONST static inline size_t leftover_bucket(size_t n)
+{
+    size_t log2 = 0;
+
+#if defined(__GNUC__) || defined(__clang__)
+    log2 = (size_t) (63 - __builtin_clzll((unsigned long long) n));
+#else
+    while (n >>= 1) {
+        ++log2;
     }
+#endif
 
-    return sum;
+    log2 -= LEFTOVER_MIN_SHIFT;
+    return log2 < LEFTOVER_BUCKETS ? log2 : LEFTOVER_BUCKETS - 1;
 }
 
-size_t arena_allocated_bytes_including_metadata(Arena *arena)
+/* Returns `true` if `pool` is in the leftover index of `arena`. It is not 
+ * always in the bucket its tail falls in, as the tail may have grown since it
+ * was filed. */
+static bool leftover_filed(const Arena *arena, const M_Pool *pool)
 {
-    return offsetof(Arena, pools)
-        + sizeof arena->pools[0] * arena->capacity
-        + arena_allocated_bytes(arena);
+    for (size_t i = 0; i < LEFTOVER_BUCKETS; ++i) {
+        for (const M_Pool *p = arena->leftovers[i]; p != nullptr; 
+                p = p->next_leftover) {
+            if (p == pool) {
+                return true;
+            }
+        }
+    }
+
+    return false;
 }
 
-static M_Pool *pool_new(void *buf, size_t capacity)
+#ifdef ARENA_CANARY
+/* Derives the canary of an arena from its address, which varies from run to 
+ * run with ASLR, and from a count of the arenas created, which may be on any
+ * thread. */
+static uint64_t canary_new(const void *seed)
 {
-    M_Pool *const pool = calloc(1, sizeof *pool);
+    static _Atomic uint64_t counter;
+    const uint64_t n = atomic_fetch_add(&counter, 1) + 1;
+    uint64_t x = (uint64_t) (uintptr_t) seed ^ n * 0x9E3779B97F4A7C15u;
 
-/* *INDENT-OFF* */
-    if (pool != nullptr) {
-        *pool = (M_Pool) {
-            .buf_len = capacity,
-            .is_heap_alloc = buf == nullptr,
-            .buf = buf ? buf : calloc(1, capacity),
-        };
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDu;
+    x ^= x >> 33;
+    x *= 0xC4CEB9FE1A85EC53u;
+    x ^= x >> 33;
+    return x;
+}
+
+/* Writes the canary of `arena` at `at`, right after a block, and records where
+ * it is. The list is allocated with malloc(), out of the reach of overruns. If
+ * it can not grow, the canary is written, but not checked. */
+static void canary_place(Arena *arena, uint8_t *at)
+{
+    D(UNPOISON(at, CANARY_SIZE));
+    memcpy(at, &arena->canary, CANARY_SIZE);
+
+    if (arena->canary_count == arena->canary_cap) {
+        const size_t cap = 
+            arena->canary_cap != 0 ? arena->canary_cap * 2 : CANARY_MIN_CAP;
+        uint8_t **const tmp = 
+            realloc(arena->canaries, cap * sizeof arena->canaries[0]);
+
+        if (tmp == nullptr) {
+            return;
+        }
+
+        arena->canaries = tmp;
+        arena->canary_cap = cap;
     }
-/* *INDENT-ON* */
 
-    return pool;
+    arena->canaries[arena->canary_count++] = at;
 }
 
-Arena *arena_new(void *buf, size_t capacity)
+/* Returns the first canary of `arena` that was overwritten, or `nullptr`. The
+ * sweep has no early exit, so that it can be vectorized, and only looks for
+ * the culprit if there is one. */
+static const uint8_t *canary_sweep(const Arena *arena)
 {
-    if (capacity == 0) {
-        if (buf != nullptr) {
-            return nullptr;
+    uint64_t diff = 0;
+
+    for (size_t i = 0; i < arena->canary_count; ++i) {
+        uint64_t v;
+
+        memcpy(&v, arena->canaries[i], CANARY_SIZE);
+        diff |= v ^ arena->canary;
+    }
+
+    for (size_t i = 0; diff != 0 && i < arena->canary_count; ++i) {
+        if (memcmp(arena->canaries[i], &arena->canary, CANARY_SIZE) != 0) {
+            return arena->canaries[i];
         }
-        capacity = DEFAULT_BUF_CAP;
     }
 
-    Arena *const arena = calloc(1,
-        sizeof *arena + (INITIAL_MPOOL_COUNT * sizeof arena->pools[0]));
+    return nullptr;
+}
 
-    if (arena == nullptr) {
-        return nullptr;
-    }
+/* Forgets the canaries of the blocks at the top of the pools of `arena`, which
+ * are about to be released. */
+static void canary_drop_tops(Arena *arena)
+{
+    size_t n = 0;
 
-    arena->capacity = INITIAL_MPOOL_COUNT;
-    arena->count = 1;
-    arena->current = 1;
-    arena->pools[0] = pool_new(buf, capacity);
+    for (size_t i = 0; i < arena->canary_count; ++i) {
+        const uintptr_t at = (uintptr_t) arena->canaries[i];
+        bool top = false;
 
-    if (arena->pools[0] == nullptr) {
-        free(arena);
-        return nullptr;
+        for (const M_Pool *pool = arena->tops; pool != nullptr && !top; 
+                pool = pool->next_top) {
+            const uintptr_t end = (uintptr_t) (pool->buf + pool->buf_len);
+
+            top = at < end && end - at <= pool->top;
+        }
+
+        if (!top) {
+            arena->canaries[n++] = arena->canaries[i];
+        }
     }
 
-    return arena;
+    arena->canary_count = n;
 }
 
-void *arena_alloc(Arena *arena, size_t alignment, size_t size)
+/* Aborts if a canary of `arena` was overwritten, as the heap it is in can not
+ * be trusted anymore. */
+static void canary_verify(const Arena *arena, const char *caller)
 {
-    if (size == 0
-        || alignment == 0 || (alignment != 1 && !is_power_of_two(alignment))
-        || !is_multiple_of(size, alignment)) {
-        return nullptr;
+    const uint8_t *const bad = canary_sweep(arena);
+
+    if (bad != nullptr) {
+        fprintf(stderr, "%s(): the block before %p overran into its canary.\n",
+                caller, (const void *) bad);
+        abort();
     }
+}
+#endif
 
-    M_Pool *curr_pool = arena->pools[arena->current - 1];
-    uint8_t *const p = curr_pool->buf + curr_pool->offset;
-    const uintptr_t original = ((uintptr_t) p);
+#ifdef ARENA_REGISTRY
+/* Copies the metrics of `arena` to its registry entry, if it has one. The 
+ * stores are relaxed, so a dump may see them from slightly different 
+ * moments. */
+static void registry_publish(const Arena *arena)
+{
+    Registry_Entry *const e = arena->entry;
 
-    if (original > UINTPTR_MAX - alignment) {
-        return nullptr;
+    if (e == nullptr) {
+        return;
     }
 
-    const uintptr_t remain = original & (alignment - 1);
-    const uintptr_t aligned =
-        remain != 0 ? original + (alignment - remain) : original;
-    const size_t offset = aligned - original;
+    atomic_store_explicit(&e->pools, arena->count, memory_order_relaxed);
+    atomic_store_explicit(&e->reserved, arena->reserved, memory_order_relaxed);
+    atomic_store_explicit(&e->used, arena->used, memory_order_relaxed);
+    atomic_store_explicit(&e->peak, arena->stats.peak_bytes_in_use, 
+                          memory_order_relaxed);
+    atomic_store_explicit(&e->pool_peak, arena->pool_peak, 
+                          memory_order_relaxed);
+}
+#endif
 
-    if (size > SIZE_MAX - offset) {
-        return nullptr;
-    }
+/* Records that `consumed` bytes of the current pool have been handed out for a
+ * request of `requested` bytes, be it a new allocation or an expansion of the
+ * last one. */
+ATTRIB_INLINE static inline void commit(Arena *arena, 
+                                        size_t requested, 
+                                        size_t consumed)
+{
+    arena->used += consumed;
 
-    size += offset;
+#ifdef ARENA_STATS
+    ArenaStats *const stats = &arena->stats;
 
-    if (size > curr_pool->buf_len - curr_pool->offset) {
-        return nullptr;
+    stats->bytes_requested += requested;
+    stats->bytes_consumed += consumed;
+    stats->padding += consumed - requested;
+
+    if (arena->used > stats->peak_bytes_in_use) {
+        stats->peak_bytes_in_use = arena->used;
+    }
+#else
+    (void) requested;
+#endif
+#ifdef ARENA_REGISTRY
+    if (arena->used - arena->large_used > arena->pool_peak) {
+        arena->pool_peak = arena->used - arena->large_used;
     }
+#endif
+    REGISTRY(registry_publish(arena));
+}
+
+bool arena_stats(const Arena *arena, ArenaStats *stats)
+{
+#ifdef ARENA_STATS
+    *stats = arena->stats;
+    stats->bytes_in_use = arena->used;
+    return true;
+#else
+    (void) arena;
+    *stats = (ArenaStats) { 0 };
+    return false;
+#endif
+}
 
-    /* Set the optional padding for alignment immediately before a user block, 
-     * and the bytes immediately following such a block to non-zero. 
-     * The intent is to trigger OBOB failures to inappropiate app use of 
-     * strlen()/strnlen(), which keep forging ahead till encountering ascii NUL. */
-    D(
-        /* 0xA5 is used in FreeBSD's PHK malloc for debugging purposes. */
-        if (remain) {
-            memset(p + (alignment - remain), 0xA5, alignment - remain);
+static bool get_varint(FILE *stream, uint64_t *v)
+{
+    uint64_t result = 0;
+
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        const int c = getc(stream);
+
+        if (c == EOF) {
+            return false;
         }
-    );
 
-    curr_pool->offset += size;
-    D(memset(curr_pool->buf + curr_pool->offset, 0xA5,
-            curr_pool->buf_len - curr_pool->offset));
+        result |= (uint64_t) (c & 0x7F) << shift;
 
-    arena->last_alloc_size = size;
+        if ((c & 0x80) == 0) {
+            *v = result;
+            return true;
+        }
+    }
 
-    /* Equal to "aligned", but preserves provenance. */
-    return p + offset;
+    return false;
 }
 
-void *arena_allocarray(Arena *arena,
-                       size_t alignment, 
-                       size_t nmemb, 
-                       size_t size)
+#ifdef ARENA_TRACE
+static uint8_t *put_varint(uint8_t *p, uint64_t v)
 {
-    if (nmemb == 0 || size == 0 || alignment == 0) {
-        return nullptr;
+    for (; v >= 0x80; v >>= 7) {
+        *p++ = (uint8_t) (v | 0x80);
     }
 
-    if (size > SIZE_MAX / nmemb) {
-        return nullptr;
-    }
+    *p++ = (uint8_t) v;
+    return p;
+}
+
+/* Returns the time in nanoseconds since the Epoch. */
+static int64_t trace_now(void)
+{
+    struct timespec ts;
 
-    return arena_alloc(arena, alignment, nmemb * size);
+    timespec_get(&ts, TIME_UTC);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
 }
 
-bool arena_realloc(Arena *arena, size_t size)
+/* Appends an event to the trace, if one is being recorded. Each event is 
+ * written with a single fwrite(), which stdio serializes between threads. */
+static void trace_record(uint64_t id, 
+                         ArenaTraceOp op, 
+                         bool ok, 
+                         size_t a, 
+                         size_t b, 
+                         size_t c)
 {
-    if (size == arena->last_alloc_size) {
-        return true;
+    FILE *const stream = atomic_load(&trace_stream);
+
+    if (stream == nullptr) {
+        return;
     }
 
-    M_Pool *const curr_pool = arena->pools[arena->current - 1];
+    const int64_t ns = trace_now() - atomic_load(&trace_epoch);
+    const size_t args[] = { a, b, c };
+    uint8_t record[TRACE_RECORD_MAX];
+    uint8_t *p = record;
 
-    if (size == 0) {
-        /* Delete allocation. */
-        curr_pool->offset -= arena->last_alloc_size;
-        arena->last_alloc_size = size;
-        return true;
+    *p++ = (uint8_t) (op | (ok ? 0 : TRACE_FAILED));
+    p = put_varint(p, ns > 0 ? (uint64_t) ns : 0);
+    p = put_varint(p, id);
+
+    for (unsigned i = 0; i < trace_nargs[op]; ++i) {
+        p = put_varint(p, args[i]);
     }
 
-    if (size < arena->last_alloc_size) {
-        /* Shrink allocation. */
-        curr_pool->offset -= arena->last_alloc_size - size;
-        arena->last_alloc_size = size;
-        return true;
+    fwrite(record, 1, (size_t) (p - record), stream);
+}
+#endif
+
+bool arena_trace_start(FILE *stream)
+{
+#ifdef ARENA_TRACE
+    /* The epoch is only set while no trace is being recorded, so events are 
+     * timed from the start of the trace they are written to. */
+    if (atomic_load(&trace_stream) != nullptr) {
+        return false;
     }
 
-    if (size > (curr_pool->buf_len - curr_pool->offset)) {
+    if (fwrite(TRACE_MAGIC, 1, TRACE_MAGIC_LEN, stream) != TRACE_MAGIC_LEN) {
         return false;
     }
 
-    /* Expand allocation. */
-    curr_pool->offset += size - arena->last_alloc_size;
-    arena->last_alloc_size = size;
-    return true;
+    FILE *expected = nullptr;
+
+    atomic_store(&trace_epoch, trace_now());
+    return atomic_compare_exchange_strong(&trace_stream, &expected, stream);
+#else
+    (void) stream;
+    return false;
+#endif
 }
 
-Arena *arena_resize(Arena *restrict arena, void *restrict buf, size_t capacity)
+void arena_trace_stop(void)
 {
-    if (capacity == 0) {
-        if (buf != nullptr) {
-            return nullptr;
-        }
-        capacity = DEFAULT_BUF_CAP;
+#ifdef ARENA_TRACE
+    FILE *const stream = atomic_exchange(&trace_stream, nullptr);
+
+    if (stream != nullptr) {
+        fflush(stream);
     }
+#endif
+}
 
-    if (arena->count >= arena->capacity) {
-        arena->capacity *= 2;
-        Arena *tmp = realloc(arena,
-            sizeof *tmp + (arena->capacity * sizeof arena->pools[0]));
+bool arena_trace_read_header(FILE *stream)
+{
+    char magic[TRACE_MAGIC_LEN];
 
-        if (tmp == nullptr) {
-            return nullptr;
-        }
+    return fread(magic, 1, sizeof magic, stream) == sizeof magic
+        && memcmp(magic, TRACE_MAGIC, sizeof magic) == 0;
+}
 
-        arena = tmp;
+int arena_trace_read(FILE *stream, ArenaTraceEvent *event)
+{
+    const int c = getc(stream);
+
+    if (c == EOF) {
+        return 0;
     }
 
-    M_Pool *const new_pool = pool_new(buf, capacity);
+    const int op = c & ~TRACE_FAILED;
 
-    if (new_pool == nullptr) {
-        return nullptr;
+    if (op < ARENA_TRACE_NEW || op > ARENA_TRACE_RESET_CONSOLIDATE) {
+        return -1;
     }
 
-    arena->pools[arena->count++] = new_pool;
-    ++arena->current;
-    return arena;
-}
+/* *INDENT-OFF* */
+    *event = (ArenaTraceEvent) {
+        .op = (ArenaTraceOp) op,
+        .ok = (c & TRACE_FAILED) == 0,
+    };
+/* *INDENT-ON* */
 
-void arena_destroy(Arena *arena)
-{
-    for (size_t i = 0; i < arena->count; ++i) {
-        if (arena->pools[i]->is_heap_alloc) {
-            free(arena->pools[i]->buf);
+    if (!get_varint(stream, &event->ns) || !get_varint(stream, &event->arena)) {
+        return -1;
+    }
+
+    for (unsigned i = 0; i < trace_nargs[op]; ++i) {
+        uint64_t v;
+
+        if (!get_varint(stream, &v) || v > SIZE_MAX) {
+            return -1;
         }
-        free(arena->pools[i]);
+
+        event->args[i] = (size_t) v;
     }
 
-    free(arena);
+    return 1;
 }
 
-void arena_reset(Arena *arena)
+bool arena_check(const Arena *arena)
 {
-    for (size_t i = 0; i < arena->count; ++i) {
-        arena->pools[i]->offset = 0;
-    }
-    arena->current = 1;
+#ifdef ARENA_CANARY
+    return canary_sweep(arena) == nullptr;
+#else
+    (void) arena;
+    return true;
+#endif
+}
+
+size_t arena_pool_capacity(Arena *arena)
+{
+    return pool_room(arena->pools[arena->current - 1]);
+}
+
+void arena_set_large_threshold(Arena *arena, size_t threshold)
+{
+    TRACE(trace_record(arena->trace_id, ARENA_TRACE_SET_LARGE_THRESHOLD, true, 
+                       threshold, 0, 0));
+    arena->large_threshold = threshold;
+}
+
+size_t arena_allocated_bytes(Arena *arena)
+{
+    return arena->reserved;
+}
+
+size_t arena_used_bytes(const Arena *arena)
+{
+    return arena->used;
+}
+
+size_t arena_pool_count(const Arena *arena)
+{
+    return arena->count;
+}
+
+bool arena_pool_info(const Arena *arena, size_t index, ArenaPoolInfo *info)
+{
+    if (index >= arena->count) {
+        return false;
+    }
+
+    const M_Pool *const pool = arena->pools[index];
+    const size_t tail = pool_room(pool);
+
+    /* Pools before the current one were left behind with whatever they had 
+     * remaining, which is only allocated from again if it is in the leftover
+     * index. The current pool, and the ones after it that a reset emptied, 
+     * can still be allocated from. */
+    const bool abandoned = 
+        index + 1 < arena->current && !leftover_filed(arena, pool);
+
+    *info = (ArenaPoolInfo) {
+        .capacity = pool->buf_len,
+        .used = pool->offset + pool->top,
+        .padding = pool->padding + pool->top_padding,
+        .abandoned = abandoned ? tail : 0,
+        .free = abandoned ? 0 : tail,
+    };
+    return true;
+}
+
+double arena_efficiency(const Arena *arena)
+{
+    size_t payload = 0;
+    size_t consumed = 0;
+
+    for (size_t i = 0; i < arena->count; ++i) {
+        ArenaPoolInfo info;
+
+        arena_pool_info(arena, i, &info);
+        payload += info.used - info.padding;
+        consumed += info.used + info.abandoned;
+    }
+
+    return consumed == 0 ? 1.0 : (double) payload / (double) consumed;
+}
+
+size_t arena_allocated_bytes_including_metadata(Arena *arena)
+{
+    return offsetof(Arena, pools)
+        + sizeof arena->pools[0] * arena->capacity
+        + arena_allocated_bytes(arena);
+}
+
+#ifdef DEBUG
+/* In debug builds, the bytes of a pool that are not handed out are kept set to
+ * 0xA5, which is used in FreeBSD's PHK malloc for debugging purposes. The 
+ * intent is to trigger OBOB failures to inappropiate app use of 
+ * strlen()/strnlen(), which keep forging ahead till encountering ascii NUL. 
+ *
+ * The bytes are set when the pool is created, and again when they are given 
+ * back by arena_realloc() or arena_reset(), so that the cost is proportional 
+ * to the bytes allocated rather than to the bytes remaining. Alignment padding
+ * is never handed out, and stays set. */
+static void debug_pool_new(M_Pool *pool)
+{
+    memset(pool->buf, 0xA5, pool->buf_len);
+    POISON(pool->buf, pool->buf_len);
+    VG(VALGRIND_CREATE_MEMPOOL(pool, 0, 0));
+    VG(VALGRIND_MAKE_MEM_NOACCESS(pool->buf, pool->buf_len));
+}
+
+/* Makes the buffer of `pool` accessible again before it is freed, or given 
+ * back to the caller who supplied it. */
+static void debug_pool_free(M_Pool *pool)
+{
+    VG(VALGRIND_DESTROY_MEMPOOL(pool));
+    VG(VALGRIND_MAKE_MEM_DEFINED(pool->buf, pool->buf_len));
+    UNPOISON(pool->buf, pool->buf_len);
+}
+
+static void debug_alloc(M_Pool *pool, void *p, size_t size)
+{
+    UNPOISON(p, size);
+#ifdef HAVE_VALGRIND
+    VALGRIND_MEMPOOL_ALLOC(pool, p, size);
+#else
+    (void) pool;
+#endif
+}
+
+/* Expands the block at `p` in place from `old_size` to `new_size` bytes. */
+static void debug_grow(M_Pool *pool, 
+                       uint8_t *p, 
+                       size_t old_size, 
+                       size_t new_size)
+{
+    UNPOISON(p + old_size, new_size - old_size);
+
+#ifdef HAVE_VALGRIND
+    if (old_size == 0) {
+        VALGRIND_MEMPOOL_ALLOC(pool, p, new_size);
+    } else {
+        VALGRIND_MEMPOOL_CHANGE(pool, p, p, new_size);
+    }
+#else
+    (void) pool;
+#endif
+}
+
+/* Shrinks the block at `p` in place from `old_size` to `new_size` bytes, and 
+ * sets the bytes given back to 0xA5. */
+static void debug_shrink(M_Pool *pool, 
+                         uint8_t *p, 
+                         size_t old_size, 
+                         size_t new_size)
+{
+    memset(p + new_size, 0xA5, old_size - new_size);
+    POISON(p + new_size, old_size - new_size);
+
+#ifdef HAVE_VALGRIND
+    if (new_size == 0) {
+        VALGRIND_MEMPOOL_FREE(pool, p);
+    } else {
+        VALGRIND_MEMPOOL_CHANGE(pool, p, p, new_size);
+    }
+#else
+    (void) pool;
+#endif
+}
+
+/* Sets the bytes handed out from `pool` back to 0xA5, padding included. */
+static void debug_reset(M_Pool *pool)
+{
+    VG(VALGRIND_MAKE_MEM_UNDEFINED(pool->buf, pool->offset));
+    UNPOISON(pool->buf, pool->offset);
+    memset(pool->buf, 0xA5, pool->offset);
+    POISON(pool->buf, pool->offset);
+    VG(VALGRIND_MEMPOOL_TRIM(pool, pool->buf, 0));
+    VG(VALGRIND_MAKE_MEM_NOACCESS(pool->buf, pool->offset));
+}
+
+/* Likewise for the bytes handed out from the end of `pool`. */
+static void debug_reset_top(M_Pool *pool)
+{
+    uint8_t *const top = pool->buf + pool->buf_len - pool->top;
+
+    VG(VALGRIND_MAKE_MEM_UNDEFINED(top, pool->top));
+    UNPOISON(top, pool->top);
+    memset(top, 0xA5, pool->top);
+    POISON(top, pool->top);
+    VG(VALGRIND_MEMPOOL_TRIM(pool, pool->buf, pool->offset));
+    VG(VALGRIND_MAKE_MEM_NOACCESS(top, pool->top));
+}
+
+/* Makes the remainder of `pool` writable, for formatting into it in place. */
+static void debug_tail_open(M_Pool *pool)
+{
+    UNPOISON(pool->buf + pool->offset, pool_room(pool));
+    VG(VALGRIND_MAKE_MEM_UNDEFINED(pool->buf + pool->offset, pool_room(pool)));
+}
+
+/* Undoes debug_tail_open(), setting the first `dirty` bytes of the remainder,
+ * which have been written to, back to 0xA5. */
+static void debug_tail_close(M_Pool *pool, size_t dirty)
+{
+    memset(pool->buf + pool->offset, 0xA5, dirty);
+    POISON(pool->buf + pool->offset, pool_room(pool));
+    VG(VALGRIND_MAKE_MEM_NOACCESS(pool->buf + pool->offset, pool_room(pool)));
+}
+
+/* Without a sanitizer to report them where they happen, overruns of the last 
+ * block of `pool` are caught afterwards, by the bytes past it no longer being
+ * 0xA5. Aborts with a message naming `caller` if so. */
+static void debug_check_tail(const M_Pool *pool, const char *caller)
+{
+#if !defined(HAVE_ASAN) && !defined(HAVE_VALGRIND)
+    const uint8_t *const end = pool->buf + pool->offset;
+    const size_t n = pool_room(pool) < TAIL_CHECK_SIZE 
+        ? pool_room(pool) 
+        : TAIL_CHECK_SIZE;
+
+    for (size_t i = 0; i < n; ++i) {
+        if (end[i] != 0xA5) {
+            fprintf(stderr, "%s(): the block before %p overran past it.\n",
+                    caller, (const void *) end);
+            abort();
+        }
+    }
+#else
+    (void) pool;
+    (void) caller;
+#endif
+}
+#endif
+
+#ifdef ARENA_GUARD
+static size_t page_size(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+#else
+    return (size_t) sysconf(_SC_PAGESIZE);
+#endif
+}
+
+/* Returns the number of bytes mapped for a buffer of `capacity` bytes, less 
+ * the guard pages. */
+static size_t guard_span(size_t capacity, size_t page)
+{
+    return round_up(round_up(capacity, ALIGNOF(max_align_t)), page);
+}
+
+/* Maps a buffer of `capacity` bytes between two inaccessible guard pages, so 
+ * that running off either end of it faults on the spot. The buffer ends as 
+ * close to the trailing guard page as the alignment of `max_align_t` allows,
+ * which leaves less than that alignment of slack. */
+static void *guard_alloc(size_t capacity)
+{
+    const size_t page = page_size();
+
+    if (capacity > SIZE_MAX - ALIGNOF(max_align_t) - 3 * page) {
+        return nullptr;
+    }
+
+    const size_t span = guard_span(capacity, page);
+    const size_t total = span + 2 * page;
+
+#ifdef _WIN32
+    uint8_t *const base = 
+        VirtualAlloc(nullptr, total, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    DWORD old;
+
+    if (base == nullptr) {
+        return nullptr;
+    }
+
+    if (!VirtualProtect(base, page, PAGE_NOACCESS, &old)
+        || !VirtualProtect(base + page + span, page, PAGE_NOACCESS, &old)) {
+        VirtualFree(base, 0, MEM_RELEASE);
+        return nullptr;
+    }
+#else
+    uint8_t *const base = mmap(nullptr, total, PROT_READ | PROT_WRITE, 
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (base == MAP_FAILED) {
+        return nullptr;
+    }
+
+    if (mprotect(base, page, PROT_NONE) != 0
+        || mprotect(base + page + span, page, PROT_NONE) != 0) {
+        munmap(base, total);
+        return nullptr;
+    }
+#endif
+
+    return base + page + span - round_up(capacity, ALIGNOF(max_align_t));
+}
+
+static void guard_free(void *buf, size_t capacity)
+{
+    const size_t page = page_size();
+    uint8_t *const base = 
+        (uint8_t *) buf - ((uintptr_t) buf & (page - 1)) - page;
+
+#ifdef _WIN32
+    (void) capacity;
+    VirtualFree(base, 0, MEM_RELEASE);
+#else
+    munmap(base, guard_span(capacity, page) + 2 * page);
+#endif
+}
+#endif
+
+/* The memory an arena holds comes from its upstream allocator, or from the C 
+ * allocator if it has none, i.e. if `alloc` is `nullptr`. Only the latter 
+ * zeroes it. */
+static void *upstream_alloc(const ArenaAllocator *a, size_t size)
+{
+    return a->alloc != nullptr ? a->alloc(a->ctx, size) : calloc(1, size);
+}
+
+static void upstream_free(const ArenaAllocator *a, void *ptr, size_t size)
+{
+    if (a->alloc != nullptr) {
+        a->free(a->ctx, ptr, size);
+    } else {
+        free(ptr);
+    }
+}
+
+/* Without a `resize` function, the block is moved to a new one. */
+static void *upstream_resize(const ArenaAllocator *a, 
+                             void *ptr, 
+                             size_t old_size, 
+                             size_t new_size)
+{
+    if (a->alloc == nullptr) {
+        return realloc(ptr, new_size);
+    }
+
+    if (a->resize != nullptr) {
+        return a->resize(a->ctx, ptr, old_size, new_size);
+    }
+
+    void *const tmp = a->alloc(a->ctx, new_size);
+
+    if (tmp != nullptr) {
+        memcpy(tmp, ptr, old_size < new_size ? old_size : new_size);
+        a->free(a->ctx, ptr, old_size);
+    }
+
+    return tmp;
+}
+
+/* Allocates the buffer of a pool, between guard pages if the library is built
+ * with `ARENA_GUARD` defined and `a` is the C allocator. */
+static void *buf_alloc(const ArenaAllocator *a, size_t capacity)
+{
+#ifdef ARENA_GUARD
+    if (a->alloc == nullptr) {
+        return guard_alloc(capacity);
+    }
+#endif
+    return upstream_alloc(a, capacity);
+}
+
+static void buf_free(const ArenaAllocator *a, void *buf, size_t capacity)
+{
+#ifdef ARENA_GUARD
+    if (a->alloc == nullptr) {
+        guard_free(buf, capacity);
+        return;
+    }
+#endif
+    upstream_free(a, buf, capacity);
+}
+
+static M_Pool *pool_new(const ArenaAllocator *a, void *buf, size_t capacity)
+{
+    M_Pool *const pool = upstream_alloc(a, sizeof *pool);
+
+    if (pool == nullptr) {
+        return nullptr;
+    }
+
+/* *INDENT-OFF* */
+    *pool = (M_Pool) {
+        .buf_len = capacity,
+        .is_heap_alloc = buf == nullptr,
+        .buf = buf ? buf : buf_alloc(a, capacity),
+    };
+/* *INDENT-ON* */
+
+    if (pool->buf == nullptr) {
+        upstream_free(a, pool, sizeof *pool);
+        return nullptr;
+    }
+
+    D(debug_pool_new(pool));
+    return pool;
+}
+
+static void pool_free(const ArenaAllocator *a, M_Pool *pool)
+{
+    D(debug_pool_free(pool));
+
+    if (pool->is_heap_alloc) {
+        buf_free(a, pool->buf, pool->buf_len);
+    }
+    upstream_free(a, pool, sizeof *pool);
+}
+
+/* The size of an arena with room for `capacity` pools. */
+ATTRIB_INLINE ATTRIB_CONST static inline size_t arena_size(size_t capacity)
+{
+    return sizeof (Arena) + capacity * sizeof (M_Pool *);
+}
+
+static Arena *create(const ArenaAllocator *a, void *buf, size_t capacity)
+{
+    if (capacity == 0) {
+        if (buf != nullptr) {
+            return nullptr;
+        }
+        capacity = DEFAULT_BUF_CAP;
+    }
+
+    Arena *const arena = upstream_alloc(a, arena_size(INITIAL_MPOOL_COUNT));
+
+    if (arena == nullptr) {
+        return nullptr;
+    }
+
+    memset(arena, 0, arena_size(INITIAL_MPOOL_COUNT));
+    arena->allocator = *a;
+    arena->capacity = INITIAL_MPOOL_COUNT;
+    arena->count = 1;
+    arena->current = 1;
+    arena->reserved = capacity;
+    arena->large_threshold = SIZE_MAX;
+    arena->pools[0] = pool_new(a, buf, capacity);
+
+    if (arena->pools[0] == nullptr) {
+        upstream_free(a, arena, arena_size(INITIAL_MPOOL_COUNT));
+        return nullptr;
+    }
+
+#ifdef ARENA_CANARY
+    arena->canary = canary_new(arena);
+#endif
+    PROBE3(pool__new, arena, capacity, arena->count);
+    return arena;
+}
+
+/* Bumps `pool` by `size` bytes aligned to `alignment`, after `lead` bytes left
+ * for a canary, or returns `nullptr` if the pool can not hold them. */
+static void *pool_alloc(M_Pool *curr_pool, 
+                        size_t lead, 
+                        size_t alignment, 
+                        size_t size)
+{
+    uint8_t *const p = curr_pool->buf + curr_pool->offset;
+    const uintptr_t original = ((uintptr_t) p) + lead;
+
+    if (original > UINTPTR_MAX - alignment) {
+        return nullptr;
+    }
+
+    const uintptr_t remain = original & (alignment - 1);
+    const uintptr_t aligned =
+        remain != 0 ? original + (alignment - remain) : original;
+    const size_t offset = aligned - original + lead;
+
+    if (size > SIZE_MAX - offset) {
+        return nullptr;
+    }
+
+    size += offset;
+
+    if (size > pool_room(curr_pool)) {
+        return nullptr;
+    }
+
+    curr_pool->offset += size;
+    curr_pool->padding += offset;
+
+    /* The padding, and the bytes following the block, are already set to 
+     * 0xA5. */
+    D(debug_alloc(curr_pool, p + offset, size - offset));
+
+    /* Equal to "aligned", but preserves provenance. */
+    return p + offset;
+}
+
+static Arena *new_arena(const ArenaAllocator *a, void *buf, size_t capacity)
+{
+    Arena *const arena = create(a, buf, capacity);
+
+#ifdef ARENA_TRACE
+    if (arena != nullptr) {
+        arena->trace_id = atomic_fetch_add(&trace_last_id, 1) + 1;
+    }
+
+    trace_record(arena != nullptr ? arena->trace_id : 0, ARENA_TRACE_NEW, 
+                 arena != nullptr, capacity, buf != nullptr, 0);
+#endif
+    return arena;
+}
+
+Arena *arena_new(void *buf, size_t capacity)
+{
+    static const ArenaAllocator c_allocator;
+
+    return new_arena(&c_allocator, buf, capacity);
+}
+
+Arena *arena_new_with(const ArenaAllocator *allocator, 
+                      void *buf, 
+                      size_t capacity)
+{
+    if (allocator->alloc == nullptr || allocator->free == nullptr) {
+        return nullptr;
+    }
+
+    return new_arena(allocator, buf, capacity);
+}
+
+/* Bumps `pool` by a block of `size` bytes aligned to `alignment`, with a canary
+ * before it if need be, and makes it the last allocation of `arena`. Returns 
+ * `nullptr` if the pool can not hold it. */
+static void *pool_take(Arena *arena, 
+                       M_Pool *pool, 
+                       size_t alignment, 
+                       size_t size)
+{
+    const size_t old_offset = pool->offset;
+    const size_t lead = canary_lead(pool);
+    void *const p = pool_alloc(pool, lead, alignment, size);
+
+    if (p == nullptr) {
+        return nullptr;
+    }
+
+#ifdef ARENA_CANARY
+    if (lead != 0) {
+        canary_place(arena, pool->buf + old_offset);
+    }
+#endif
+    /* The padding is not part of the allocation as far as arena_realloc() is
+     * concerned. */
+    arena->last_alloc_size = size;
+    arena->last_is_large = false;
+    arena->last_leftover = nullptr;
+    STATS(++arena->stats.allocs);
+    commit(arena, size, pool->offset - old_offset);
+    return p;
+}
+
+/* Files the tail of `pool`, which is no longer the current pool, in the 
+ * leftover index of `arena`. */
+static void leftover_add(Arena *arena, M_Pool *pool)
+{
+    const size_t tail = pool_room(pool);
+
+    if (tail >> LEFTOVER_MIN_SHIFT == 0) {
+        return;
+    }
+
+    const size_t i = leftover_bucket(tail);
+
+    pool->next_leftover = arena->leftovers[i];
+    arena->leftovers[i] = pool;
+}
+
+/* Allocates from the tail of a pool before the current one. 
+ *
+ * Every tail in the buckets from `sure` up can hold the block with any 
+ * padding, so the first one is taken, unless arena_realloc() has since 
+ * expanded a block at its end, in which case it is filed again, lower. The 
+ * bucket `need` falls in, and the last bucket, are searched for the first tail
+ * that fits. The pool is filed again by what remains of its tail. */
+static void *leftover_alloc(Arena *arena, size_t alignment, size_t size)
+{
+    if (size > SIZE_MAX - alignment - CANARY_SIZE) {
+        return nullptr;
+    }
+
+    const size_t need = size + alignment - 1 + CANARY_SIZE;
+    const size_t min = (size_t) 1 << LEFTOVER_MIN_SHIFT;
+    const size_t sure = need > min ? leftover_bucket(need - 1) + 1 : 0;
+
+    for (size_t i = need > min ? leftover_bucket(need) : 0; 
+            i < LEFTOVER_BUCKETS; ++i) {
+        M_Pool **link = &arena->leftovers[i];
+
+        while (*link != nullptr) {
+            M_Pool *const pool = *link;
+            void *const p = pool_take(arena, pool, alignment, size);
+
+            if (p == nullptr && i < sure) {
+                link = &pool->next_leftover;
+                continue;
+            }
+
+            *link = pool->next_leftover;
+            leftover_add(arena, pool);
+
+            if (p != nullptr) {
+                arena->last_leftover = pool;
+                STATS(++arena->stats.leftover_allocs);
+                return p;
+            }
+        }
+    }
+
+    return nullptr;
+}
+
+/* Counts a request of `size` bytes aligned to `alignment` that `arena` could 
+ * not satisfy, and returns `nullptr`. */
+static void *alloc_fail(Arena *arena, size_t alignment, size_t size)
+{
+    /* Unused if neither ARENA_STATS nor ARENA_USDT is defined. */
+    (void) arena;
+    (void) alignment;
+    (void) size;
+    STATS(++arena->stats.failures);
+    PROBE4(alloc__fail, arena, alignment, size, arena->count);
+    return nullptr;
+}
+
+/* Gives a block of `size` bytes aligned to `alignment` a buffer of its own, 
+ * between guard pages if the library is built with `ARENA_GUARD` defined, and
+ * links it into `arena`. The current pool is left as it is. */
+static void *large_alloc(Arena *arena, size_t alignment, size_t size)
+{
+    const size_t slack = 
+        alignment > ALIGNOF(max_align_t) ? alignment - 1 : 0;
+
+    if (size > SIZE_MAX - slack) {
+        return alloc_fail(arena, alignment, size);
+    }
+
+    Large *const large = upstream_alloc(&arena->allocator, sizeof *large);
+
+    if (large == nullptr) {
+        return alloc_fail(arena, alignment, size);
+    }
+
+    large->len = size + slack;
+    large->buf = buf_alloc(&arena->allocator, large->len);
+
+    if (large->buf == nullptr) {
+        upstream_free(&arena->allocator, large, sizeof *large);
+        return alloc_fail(arena, alignment, size);
+    }
+
+    const uintptr_t remain = (uintptr_t) large->buf & (alignment - 1);
+
+    large->next = arena->large;
+    arena->large = large;
+    arena->reserved += large->len;
+    arena->large_used += size;
+    arena->last_alloc_size = size;
+    arena->last_is_large = true;
+    arena->last_leftover = nullptr;
+    STATS(++arena->stats.allocs);
+    STATS(++arena->stats.large_allocs);
+    commit(arena, size, size);
+    PROBE3(large__alloc, arena, alignment, size);
+    return remain != 0 ? large->buf + (alignment - remain) : large->buf;
+}
+
+/* Resizes the block last given a buffer of its own in place, which is at the 
+ * head of the list. Deleting it frees the buffer. */
+static bool large_realloc(Arena *arena, size_t size)
+{
+    Large *const large = arena->large;
+
+    if (size == 0) {
+        arena->large = large->next;
+        arena->reserved -= large->len;
+        arena->used -= arena->last_alloc_size;
+        arena->large_used -= arena->last_alloc_size;
+        buf_free(&arena->allocator, large->buf, large->len);
+        upstream_free(&arena->allocator, large, sizeof *large);
+        arena->last_alloc_size = 0;
+        arena->last_is_large = false;
+        return true;
+    }
+
+    if (size < arena->last_alloc_size) {
+        arena->used -= arena->last_alloc_size - size;
+        arena->large_used -= arena->last_alloc_size - size;
+        arena->last_alloc_size = size;
+        return true;
+    }
+
+    /* The buffer was sized exactly, so whatever slack there is belongs to the
+     * alignment. */
+    STATS(++arena->stats.failures);
+    PROBE3(realloc__fail, arena, size, arena->count);
+    return false;
+}
+
+/* Frees the blocks that were given buffers of their own. */
+static void large_free_all(Arena *arena)
+{
+    for (Large *large = arena->large, *next; large != nullptr; large = next) {
+        next = large->next;
+        arena->reserved -= large->len;
+        buf_free(&arena->allocator, large->buf, large->len);
+        upstream_free(&arena->allocator, large, sizeof *large);
+    }
+
+    arena->large = nullptr;
+    arena->large_used = 0;
+    arena->last_is_large = false;
+}
+
+static void *alloc_aligned(Arena *arena, size_t alignment, size_t size)
+{
+    if (size == 0
+        || alignment == 0 || (alignment != 1 && !is_power_of_two(alignment))
+        || !is_multiple_of(size, alignment)) {
+        return nullptr;
+    }
+
+    for (;;) {
+        void *p = pool_take(arena, arena->pools[arena->current - 1], 
+                            alignment, size);
+
+        if (p != nullptr) {
+            return p;
+        }
+
+        p = leftover_alloc(arena, alignment, size);
+
+        if (p != nullptr) {
+            return p;
+        }
+
+        /* Rather than abandon the rest of the current pool, or fail for want 
+         * of a pool large enough. */
+        if (size >= arena->large_threshold) {
+            return large_alloc(arena, alignment, size);
+        }
+
+        if (arena->current == arena->count) {
+            return alloc_fail(arena, alignment, size);
+        }
+
+        /* The pools after the current one were emptied by arena_reset(). 
+         * Move on to the next one instead of failing. */
+        leftover_add(arena, arena->pools[arena->current - 1]);
+        ++arena->current;
+        arena->last_alloc_size = 0;
+        arena->last_is_large = false;
+        arena->last_leftover = nullptr;
+    }
+}
+
+void *arena_alloc(Arena *arena, size_t alignment, size_t size)
+{
+    void *const p = alloc_aligned(arena, alignment, size);
+
+    TRACE(trace_record(arena->trace_id, ARENA_TRACE_ALLOC, p != nullptr, 
+                       alignment, size, 0));
+    return p;
+}
+
+static void *allocarray(Arena *arena,
+                        size_t alignment, 
+                        size_t nmemb, 
+                        size_t size)
+{
+    if (nmemb == 0 || size == 0 || alignment == 0) {
+        return nullptr;
+    }
+
+    if (size > SIZE_MAX / nmemb) {
+        return nullptr;
+    }
+
+    return alloc_aligned(arena, alignment, nmemb * size);
+}
+
+void *arena_allocarray(Arena *arena,
+                       size_t alignment, 
+                       size_t nmemb, 
+                       size_t size)
+{
+    void *const p = allocarray(arena, alignment, nmemb, size);
+
+    TRACE(trace_record(arena->trace_id, ARENA_TRACE_ALLOCARRAY, p != nullptr, 
+                       alignment, nmemb, size));
+    return p;
+}
+
+static void *alloc_top(Arena *arena, size_t alignment, size_t size)
+{
+    if (size == 0
+        || alignment == 0 || (alignment != 1 && !is_power_of_two(alignment))
+        || !is_multiple_of(size, alignment)) {
+        return nullptr;
+    }
+
+    M_Pool *const pool = arena->pools[arena->current - 1];
+
+    if (size <= pool_room(pool)) {
+        const uintptr_t end = 
+            (uintptr_t) (pool->buf + pool->buf_len - pool->top);
+
+        /* A canary below each block guards it against the one under it, 
+         * from the top or from the bottom. */
+        const size_t consumed = CANARY_SIZE 
+            + (size_t) (end - ((end - size) & ~(uintptr_t) (alignment - 1)));
+
+        if (consumed <= pool_room(pool)) {
+            if (pool->top == 0) {
+                pool->next_top = arena->tops;
+                arena->tops = pool;
+            }
+
+            pool->top += consumed;
+            pool->top_padding += consumed - size;
+
+            /* Equal to the aligned address, but preserves provenance. */
+            uint8_t *const p = 
+                pool->buf + pool->buf_len - pool->top + CANARY_SIZE;
+
+#ifdef ARENA_CANARY
+            canary_place(arena, p - CANARY_SIZE);
+#endif
+            D(debug_alloc(pool, p, size));
+            STATS(++arena->stats.allocs);
+            commit(arena, size, consumed);
+            return p;
+        }
+    }
+
+    return alloc_fail(arena, alignment, size);
+}
+
+void *arena_alloc_top(Arena *arena, size_t alignment, size_t size)
+{
+    void *const p = alloc_top(arena, alignment, size);
+
+    TRACE(trace_record(arena->trace_id, ARENA_TRACE_ALLOC_TOP, p != nullptr, 
+                       alignment, size, 0));
+    return p;
+}
+
+void arena_reset_top(Arena *arena)
+{
+    TRACE(trace_record(arena->trace_id, ARENA_TRACE_RESET_TOP, true, 0, 0, 0));
+
+#ifdef ARENA_CANARY
+    canary_verify(arena, "arena_reset_top");
+    canary_drop_tops(arena);
+#endif
+
+    /* Usually just the current pool, however many pools there are. */
+    for (M_Pool *pool = arena->tops; pool != nullptr; pool = pool->next_top) {
+        D(debug_reset_top(pool));
+        arena->used -= pool->top;
+        pool->top = 0;
+        pool->top_padding = 0;
+    }
+
+    arena->tops = nullptr;
+
+    REGISTRY(registry_publish(arena));
+}
+
+static bool realloc_last(Arena *arena, size_t size)
+{
+    if (size == arena->last_alloc_size) {
+        return true;
+    }
+
+    if (arena->last_is_large) {
+        return large_realloc(arena, size);
+    }
+
+    M_Pool *const curr_pool = arena->last_leftover != nullptr 
+        ? arena->last_leftover : arena->pools[arena->current - 1];
+
+    if (size == 0) {
+        /* Delete allocation. */
+        curr_pool->offset -= arena->last_alloc_size;
+        arena->used -= arena->last_alloc_size;
+        D(debug_shrink(curr_pool, curr_pool->buf + curr_pool->offset - size, 
+                       arena->last_alloc_size, size));
+        arena->last_alloc_size = size;
+        return true;
+    }
+
+    if (size < arena->last_alloc_size) {
+        /* Shrink allocation. */
+        curr_pool->offset -= arena->last_alloc_size - size;
+        arena->used -= arena->last_alloc_size - size;
+        D(debug_shrink(curr_pool, curr_pool->buf + curr_pool->offset - size, 
+                       arena->last_alloc_size, size));
+        arena->last_alloc_size = size;
+        return true;
+    }
+
+    if (size - arena->last_alloc_size > pool_room(curr_pool)) {
+        STATS(++arena->stats.failures);
+        PROBE3(realloc__fail, arena, size, arena->count);
+        return false;
+    }
+
+    /* Expand allocation. */
+    curr_pool->offset += size - arena->last_alloc_size;
+    commit(arena, size - arena->last_alloc_size, 
+           size - arena->last_alloc_size);
+    D(debug_grow(curr_pool, curr_pool->buf + curr_pool->offset - size, 
+                 arena->last_alloc_size, size));
+    arena->last_alloc_size = size;
+    return true;
+}
+
+bool arena_realloc(Arena *arena, size_t size)
+{
+    const bool ok = realloc_last(arena, size);
+
+    REGISTRY(registry_publish(arena));
+    TRACE(trace_record(arena->trace_id, ARENA_TRACE_REALLOC, ok, size, 0, 0));
+    return ok;
+}
+
+/* Points the children of `arena`, and its parent's list of children, at 
+ * `arena`, which was moved from `old`. */
+static void relink(Arena *arena, uintptr_t old)
+{
+    for (Arena *child = arena->first_child; child != nullptr; 
+            child = child->next_sibling) {
+        child->parent = arena;
+        child->allocator.ctx = arena;
+    }
+
+    if (arena->parent != nullptr) {
+        Arena **link = &arena->parent->first_child;
+
+        while ((uintptr_t) *link != old) {
+            link = &(*link)->next_sibling;
+        }
+
+        *link = arena;
+    }
+}
+
+/* Removes `arena` from the children of its parent. */
+static void unlink_child(Arena *arena)
+{
+    Arena **link = &arena->parent->first_child;
+
+    while (*link != arena) {
+        link = &(*link)->next_sibling;
+    }
+
+    *link = arena->next_sibling;
+}
+
+static Arena *add_pool(Arena *restrict arena, 
+                       void *restrict buf, 
+                       size_t capacity)
+{
+    if (capacity == 0) {
+        if (buf != nullptr) {
+            return nullptr;
+        }
+        capacity = DEFAULT_BUF_CAP;
+    }
+
+    /* The pool is made first, so that the arena is left as it was, and where
+     * it was, on failure. */
+    M_Pool *const new_pool = pool_new(&arena->allocator, buf, capacity);
+
+    if (new_pool == nullptr) {
+        return nullptr;
+    }
+
+    if (arena->count >= arena->capacity) {
+        const uintptr_t old = (uintptr_t) arena;
+        const ArenaAllocator allocator = arena->allocator;
+        Arena *const tmp = upstream_resize(&allocator, arena, 
+            arena_size(arena->capacity), arena_size(arena->capacity * 2));
+
+        if (tmp == nullptr) {
+            pool_free(&allocator, new_pool);
+            return nullptr;
+        }
+
+        arena = tmp;
+        arena->capacity *= 2;
+        relink(arena, old);
+    }
+
+    /* Including the pools after the current one that a reset emptied. */
+    for (size_t i = arena->current - 1; i < arena->count; ++i) {
+        leftover_add(arena, arena->pools[i]);
+    }
+
+    arena->pools[arena->count++] = new_pool;
+    arena->current = arena->count;
+    arena->reserved += capacity;
+    arena->last_alloc_size = 0;
+    arena->last_is_large = false;
+    arena->last_leftover = nullptr;
+    STATS(++arena->stats.pools_added);
+    REGISTRY(registry_publish(arena));
+    PROBE3(pool__new, arena, capacity, arena->count);
+    return arena;
+}
+
+Arena *arena_resize(Arena *restrict arena, void *restrict buf, size_t capacity)
+{
+#ifdef ARENA_TRACE
+    const uint64_t id = arena->trace_id;
+#endif
+    Arena *const resized = add_pool(arena, buf, capacity);
+
+    TRACE(trace_record(id, ARENA_TRACE_RESIZE, resized != nullptr, capacity, 
+                       buf != nullptr, 0));
+    return resized;
+}
+
+#ifdef ARENA_REGISTRY
+/* Returns the hint for `name`, truncated as the registry truncates it. If there
+ * is none, pushes a new one if `create` is `true`, else returns `nullptr`. */
+static Capacity_Hint *capacity_find(const char *name, bool create)
+{
+    char key[REGISTRY_NAME_MAX];
+
+    snprintf(key, sizeof key, "%s", name);
+
+    Capacity_Hint *const head = atomic_load(&capacity_hints);
+
+    for (Capacity_Hint *h = head; h != nullptr; h = h->next) {
+        if (strcmp(h->name, key) == 0) {
+            return h;
+        }
+    }
+
+    if (!create) {
+        return nullptr;
+    }
+
+    Capacity_Hint *const h = calloc(1, sizeof *h);
+
+    if (h == nullptr) {
+        return nullptr;
+    }
+
+    memcpy(h->name, key, sizeof key);
+    atomic_init(&h->loaded, 0);
+    atomic_init(&h->peak, 0);
+    h->next = head;
+
+    for (Capacity_Hint *seen = head;;) {
+        if (atomic_compare_exchange_weak(&capacity_hints, &h->next, h)) {
+            return h;
+        }
+
+        /* Another thread pushed hints since the list was scanned, maybe one
+         * for the same name. Only those need a look. */
+        for (Capacity_Hint *o = h->next; o != seen; o = o->next) {
+            if (strcmp(o->name, key) == 0) {
+                free(h);
+                return o;
+            }
+        }
+
+        seen = h->next;
+    }
+}
+
+/* Raises the peak recorded for `name` to `peak`. Lost on allocation 
+ * failure. */
+static void capacity_record(const char *name, size_t peak)
+{
+    Capacity_Hint *const h = capacity_find(name, true);
+
+    if (h == nullptr) {
+        return;
+    }
+
+    size_t old = atomic_load(&h->peak);
+
+    while (old < peak 
+           && !atomic_compare_exchange_weak(&h->peak, &old, peak)) {
+        continue;
+    }
+}
+#endif
+
+void arena_destroy(Arena *arena)
+{
+    while (arena->first_child != nullptr) {
+        arena_destroy(arena->first_child);
+    }
+
+    if (arena->parent != nullptr) {
+        unlink_child(arena);
+    }
+
+    TRACE(trace_record(arena->trace_id, ARENA_TRACE_DESTROY, true, 0, 0, 0));
+    PROBE3(destroy, arena, arena->reserved, arena->count);
+
+#ifdef ARENA_CANARY
+    canary_verify(arena, "arena_destroy");
+    free(arena->canaries);
+#endif
+#ifdef ARENA_PROFILE
+    if (arena->profile != nullptr) {
+        if (arena->profile->on_destroy != nullptr) {
+            arena_profile_dump(arena, arena->profile->on_destroy);
+        }
+        free(arena->profile);
+    }
+#endif
+#ifdef ARENA_REGISTRY
+    if (arena->entry != nullptr) {
+        capacity_record(arena->entry->name, arena->pool_peak);
+        atomic_store(&arena->entry->in_use, false);
+    }
+#endif
+
+    for (size_t i = 0; i < arena->count; ++i) {
+        D(debug_check_tail(arena->pools[i], "arena_destroy"));
+        pool_free(&arena->allocator, arena->pools[i]);
+    }
+
+    large_free_all(arena);
+
+    const ArenaAllocator allocator = arena->allocator;
+
+    upstream_free(&allocator, arena, arena_size(arena->capacity));
+}
+
+/* Destroys the children of `arena`, which live in the pools about to be 
+ * reused. */
+static void destroy_children(Arena *arena)
+{
+    while (arena->first_child != nullptr) {
+        arena_destroy(arena->first_child);
+    }
+}
+
+/* Resets `arena`, whose children have been destroyed. Tracing is left to the 
+ * callers, which record different events. */
+static void reset(Arena *arena)
+{
+    PROBE3(reset, arena, arena->used, arena->count);
+
+#ifdef ARENA_CANARY
+    canary_verify(arena, "arena_reset");
+    arena->canary_count = 0;
+#endif
+
+    for (size_t i = 0; i < arena->count; ++i) {
+        D(debug_check_tail(arena->pools[i], "arena_reset"));
+        D(debug_reset(arena->pools[i]));
+        D(debug_reset_top(arena->pools[i]));
+        arena->pools[i]->offset = 0;
+        arena->pools[i]->padding = 0;
+        arena->pools[i]->top = 0;
+        arena->pools[i]->top_padding = 0;
+    }
+    large_free_all(arena);
+    memset(arena->leftovers, 0, sizeof arena->leftovers);
+    arena->last_leftover = nullptr;
+    arena->tops = nullptr;
+    arena->current = 1;
+    arena->last_alloc_size = 0;
+    arena->used = 0;
+    STATS(++arena->stats.resets);
+    REGISTRY(registry_publish(arena));
+}
+
+void arena_reset(Arena *arena)
+{
+    destroy_children(arena);
+    TRACE(trace_record(arena->trace_id, ARENA_TRACE_RESET, true, 0, 0, 0));
+    reset(arena);
+}
+
+static bool reset_consolidate(Arena *arena, double slack)
+{
+    size_t capacity = 0;
+    bool owned = true;
+
+    for (size_t i = 0; i < arena->count; ++i) {
+        capacity += slack > 0.0 
+            ? arena->pools[i]->offset + arena->pools[i]->top
+            : arena->pools[i]->buf_len;
+        owned &= arena->pools[i]->is_heap_alloc;
+    }
+
+    destroy_children(arena);
+    reset(arena);
+
+    if (arena->count == 1) {
+        return true;
+    }
+
+    if (!owned) {
+        return false;
+    }
+
+    if (slack > 0.0) {
+        const double scaled = (double) capacity * slack;
+
+        if (scaled >= (double) SIZE_MAX) {
+            return false;
+        }
+
+        capacity = round_up((size_t) scaled, ALIGNOF(max_align_t));
+    }
+
+    /* Never below the pool the arena was created with. */
+    if (capacity < arena->pools[0]->buf_len) {
+        capacity = arena->pools[0]->buf_len;
+    }
+
+    M_Pool *const pool = pool_new(&arena->allocator, nullptr, capacity);
+
+    if (pool == nullptr) {
+        return false;
+    }
+
+    for (size_t i = 0; i < arena->count; ++i) {
+        arena->reserved -= arena->pools[i]->buf_len;
+        pool_free(&arena->allocator, arena->pools[i]);
+    }
+
+    arena->pools[0] = pool;
+    arena->count = 1;
+    arena->reserved += capacity;
+    REGISTRY(registry_publish(arena));
+    PROBE3(pool__new, arena, capacity, arena->count);
+    return true;
+}
+
+#ifdef ARENA_TRACE
+/* Returns `slack` in the units it is recorded in. */
+static size_t trace_slack(double slack)
+{
+    if (!(slack > 0.0)) {
+        return 0;
+    }
+
+    const double scaled = slack * ARENA_TRACE_SLACK_SCALE + 0.5;
+
+    if (scaled < 1.0) {
+        return 1;
+    }
+
+    return scaled < (double) SIZE_MAX ? (size_t) scaled : SIZE_MAX;
+}
+#endif
+
+bool arena_reset_consolidate(Arena *arena, double slack)
+{
+    const bool ok = reset_consolidate(arena, slack);
+
+    TRACE(trace_record(arena->trace_id, ARENA_TRACE_RESET_CONSOLIDATE, ok, 
+                       trace_slack(slack), 0, 0));
+    return ok;
+}
+
+/* Returns `true` if `ptr` is in a pool or a large block of `arena`. */
+static bool owns(const Arena *arena, const void *ptr)
+{
+    const uintptr_t p = (uintptr_t) ptr;
+
+    for (size_t i = 0; i < arena->count; ++i) {
+        const uintptr_t buf = (uintptr_t) arena->pools[i]->buf;
+
+        if (p >= buf && p - buf < arena->pools[i]->buf_len) {
+            return true;
+        }
+    }
+
+    for (const Large *large = arena->large; large != nullptr; 
+            large = large->next) {
+        if (p >= (uintptr_t) large->buf 
+            && p - (uintptr_t) large->buf < large->len) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* The upstream allocator of a child arena. Blocks come from the parent, and 
+ * are reclaimed with it, or from the parent's own upstream allocator if it is
+ * full.
+ *
+ * The blocks must never be resized through the parent, so the parent's last 
+ * allocation is restored afterwards, if it is still where arena_realloc() 
+ * would look for it. Otherwise, as when the block went right after it, the 
+ * parent is left with no last allocation. */
+static void *child_alloc(void *ctx, size_t size)
+{
+    Arena *const parent = ctx;
+    const size_t last_alloc_size = parent->last_alloc_size;
+    const bool last_is_large = parent->last_is_large;
+    M_Pool *const last_leftover = parent->last_leftover;
+    const Large *const large = parent->large;
+    const M_Pool *const pool = last_leftover != nullptr 
+        ? last_leftover : parent->pools[parent->current - 1];
+    const size_t offset = pool->offset;
+
+    void *const p = arena_alloc(parent, ALIGNOF(max_align_t), 
+                                round_up(size, ALIGNOF(max_align_t)));
+    const bool intact = last_is_large 
+        ? parent->large == large
+        : pool->offset == offset 
+            && (last_leftover != nullptr 
+                || parent->pools[parent->current - 1] == pool);
+
+    parent->last_alloc_size = intact ? last_alloc_size : 0;
+    parent->last_is_large = intact && last_is_large;
+    parent->last_leftover = intact ? last_leftover : nullptr;
+    return p != nullptr ? p : upstream_alloc(&parent->allocator, size);
+}
+
+static void child_free(void *ctx, void *ptr, size_t size)
+{
+    const Arena *const parent = ctx;
+
+    if (!owns(parent, ptr)) {
+        upstream_free(&parent->allocator, ptr, size);
+    }
+}
+
+Arena *arena_new_child(Arena *parent, size_t capacity)
+{
+    const ArenaAllocator allocator = {
+        .alloc = child_alloc,
+        .free = child_free,
+        .ctx = parent,
+    };
+    Arena *const child = new_arena(&allocator, nullptr, capacity);
+
+    if (child != nullptr) {
+        child->parent = parent;
+        child->next_sibling = parent->first_child;
+        parent->first_child = child;
+    }
+
+    return child;
+}
+
+#ifdef ARENA_REGISTRY
+/* Claims a released entry of the registry, or pushes a new one, for `arena`. 
+ * Returns `false` on allocation failure. */
+static bool registry_add(Arena *arena, const char *name)
+{
+    char key[REGISTRY_NAME_MAX];
+
+    /* Truncated if need be. */
+    snprintf(key, sizeof key, "%s", name);
+
+    Registry_Entry *entry = atomic_load(&registry);
+
+    for (; entry != nullptr; entry = entry->next) {
+        bool expected = false;
+
+        if (strcmp(entry->name, key) == 0
+            && atomic_compare_exchange_strong(&entry->in_use, &expected, true)) {
+            break;
+        }
+    }
+
+    if (entry == nullptr) {
+        entry = calloc(1, sizeof *entry);
+
+        if (entry == nullptr) {
+            return false;
+        }
+
+        memcpy(entry->name, key, sizeof key);
+        atomic_init(&entry->in_use, true);
+        atomic_init(&entry->pools, 0);
+        atomic_init(&entry->reserved, 0);
+        atomic_init(&entry->used, 0);
+        atomic_init(&entry->peak, 0);
+        atomic_init(&entry->pool_peak, 0);
+        entry->next = atomic_load(&registry);
+
+        while (!atomic_compare_exchange_weak(&registry, &entry->next, entry)) {
+            continue;
+        }
+    }
+
+    arena->entry = entry;
+    registry_publish(arena);
+    return true;
+}
+
+/* Writes to a stream, or to a buffer the way snprintf() does. */
+typedef struct sink {
+    FILE *stream;
+    char *buf;
+    size_t size;
+    size_t len;
+    bool failed;
+} Sink;
+
+ATTRIB_PRINTF(2, 3) static void sink_printf(Sink *sink, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+
+    if (sink->stream != nullptr) {
+        n = vfprintf(sink->stream, fmt, ap);
+    } else {
+        const size_t at = sink->len < sink->size ? sink->len : sink->size;
+
+        n = vsnprintf(sink->buf != nullptr ? sink->buf + at : nullptr, 
+                      sink->size - at, fmt, ap);
+    }
+
+    va_end(ap);
+
+    if (n < 0) {
+        sink->failed = true;
+    } else {
+        sink->len += (size_t) n;
+    }
+}
+
+/* Writes `name` escaped for a JSON string or a Prometheus label value, which 
+ * both take backslash escapes for backslashes, quotes and newlines. JSON 
+ * also requires the other control characters to be escaped. */
+static void sink_name(Sink *sink, const char *name, bool json)
+{
+    for (const unsigned char *c = (const unsigned char *) name; *c; ++c) {
+        if (*c == '\\' || *c == '"') {
+            sink_printf(sink, "\\%c", *c);
+        } else if (*c == '\n') {
+            sink_printf(sink, "\\n");
+        } else if (json && *c < 0x20) {
+            sink_printf(sink, "\\u%04x", *c);
+        } else {
+            sink_printf(sink, "%c", *c);
+        }
+    }
+}
+
+static size_t metric_pools(const Registry_Entry *e)
+{
+    return atomic_load_explicit(&e->pools, memory_order_relaxed);
+}
+
+static size_t metric_reserved(const Registry_Entry *e)
+{
+    return atomic_load_explicit(&e->reserved, memory_order_relaxed);
+}
+
+static size_t metric_used(const Registry_Entry *e)
+{
+    return atomic_load_explicit(&e->used, memory_order_relaxed);
+}
+
+static size_t metric_peak(const Registry_Entry *e)
+{
+    return atomic_load_explicit(&e->peak, memory_order_relaxed);
+}
+
+static const struct {
+    const char *name;
+    const char *help;
+    size_t (*get)(const Registry_Entry *);
+} registry_metrics[] = {
+    { "pools", "Number of pools.", metric_pools },
+    { "reserved_bytes", "Bytes reserved for the pools.", metric_reserved },
+    { "used_bytes", "Bytes handed out since the last reset.", metric_used },
+    { "peak_used_bytes", "Highest value of used_bytes.", metric_peak },
+};
+
+static void registry_dump(Sink *sink, ArenaDumpFormat format)
+{
+    const size_t nmetrics = 
+        sizeof registry_metrics / sizeof registry_metrics[0];
+    const Registry_Entry *const head = atomic_load(&registry);
+
+    if (format == ARENA_DUMP_JSON) {
+        const char *sep = "";
+
+        sink_printf(sink, "{\"arenas\":[");
+
+        for (const Registry_Entry *e = head; e != nullptr; e = e->next) {
+            if (!atomic_load(&e->in_use)) {
+                continue;
+            }
+
+            sink_printf(sink, "%s{\"name\":\"", sep);
+            sink_name(sink, e->name, true);
+            sink_printf(sink, "\"");
+
+            for (size_t i = 0; i < nmetrics; ++i) {
+                sink_printf(sink, ",\"%s\":%zu", registry_metrics[i].name, 
+                            registry_metrics[i].get(e));
+            }
+
+            sink_printf(sink, "}");
+            sep = ",";
+        }
+
+        sink_printf(sink, "]}\n");
+        return;
+    }
+
+    for (size_t i = 0; i < nmetrics; ++i) {
+        sink_printf(sink, "# HELP arena_%s %s\n", registry_metrics[i].name, 
+                    registry_metrics[i].help);
+        sink_printf(sink, "# TYPE arena_%s gauge\n", registry_metrics[i].name);
+
+        for (const Registry_Entry *e = head; e != nullptr; e = e->next) {
+            if (!atomic_load(&e->in_use)) {
+                continue;
+            }
+
+            sink_printf(sink, "arena_%s{name=\"", registry_metrics[i].name);
+            sink_name(sink, e->name, false);
+            sink_printf(sink, "\"} %zu\n", registry_metrics[i].get(e));
+        }
+    }
+}
+#endif
+
+Arena *arena_new_named(void *buf, size_t capacity, const char *name)
+{
+#ifdef ARENA_REGISTRY
+    if (buf == nullptr && capacity == 0) {
+        const Capacity_Hint *const h = capacity_find(name, false);
+
+        /* The arena does not grow by itself, so it is given room for a run
+         * that peaks higher than the last one, and never less than the 
+         * default. */
+        if (h != nullptr) {
+            const size_t loaded = atomic_load(&h->loaded);
+
+            capacity = loaded <= SIZE_MAX / 2
+                ? round_up(loaded + (loaded >> CAPACITY_SLACK_SHIFT), 
+                           ALIGNOF(max_align_t)) 
+                : loaded;
+
+            if (capacity < DEFAULT_BUF_CAP) {
+                capacity = DEFAULT_BUF_CAP;
+            }
+        }
+    }
+#endif
+
+    Arena *const arena = arena_new(buf, capacity);
+
+#ifdef ARENA_REGISTRY
+    if (arena != nullptr && !registry_add(arena, name)) {
+        arena_destroy(arena);
+        return nullptr;
+    }
+#else
+    (void) name;
+#endif
+    return arena;
+}
+
+bool arena_registry_dump(FILE *stream, ArenaDumpFormat format)
+{
+#ifdef ARENA_REGISTRY
+    Sink sink = { .stream = stream };
+
+    registry_dump(&sink, format);
+    return !sink.failed;
+#else
+    (void) stream;
+    (void) format;
+    return false;
+#endif
+}
+
+size_t arena_registry_dump_buf(char *buf, size_t size, ArenaDumpFormat format)
+{
+#ifdef ARENA_REGISTRY
+    Sink sink = { .buf = buf, .size = size };
+
+    registry_dump(&sink, format);
+    return sink.failed ? 0 : sink.len;
+#else
+    (void) format;
+
+    if (size != 0) {
+        buf[0] = '\0';
+    }
+    return 0;
+#endif
+}
+
+bool arena_capacity_load(const char *path)
+{
+#ifdef ARENA_REGISTRY
+    FILE *const stream = fopen(path, "r");
+    char line[REGISTRY_NAME_MAX + 32];
+    bool ok = true;
+
+    if (stream == nullptr) {
+        return false;
+    }
+
+    while (fgets(line, sizeof line, stream) != nullptr) {
+        char name[REGISTRY_NAME_MAX];
+        size_t capacity;
+
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+
+        /* 63 is REGISTRY_NAME_MAX - 1. */
+        if (sscanf(line, "%zu %63[^\n]", &capacity, name) != 2) {
+            ok = false;
+            continue;
+        }
+
+        Capacity_Hint *const h = capacity_find(name, true);
+
+        if (h == nullptr) {
+            ok = false;
+            break;
+        }
+
+        atomic_store(&h->loaded, capacity);
+    }
+
+    ok &= !ferror(stream);
+    fclose(stream);
+    return ok;
+#else
+    (void) path;
+    return false;
+#endif
+}
+
+bool arena_capacity_save(const char *path)
+{
+#ifdef ARENA_REGISTRY
+    /* The live arenas, through the peaks they publish, as they may be in use
+     * on other threads. */
+    for (const Registry_Entry *e = atomic_load(&registry); e != nullptr; 
+            e = e->next) {
+        if (atomic_load(&e->in_use)) {
+            capacity_record(e->name, 
+                atomic_load_explicit(&e->pool_peak, memory_order_relaxed));
+        }
+    }
+
+    FILE *const stream = fopen(path, "w");
+
+    if (stream == nullptr) {
+        return false;
+    }
+
+    fprintf(stream, "# Peak bytes used from the pools of the named arenas.\n");
+
+    for (const Capacity_Hint *h = atomic_load(&capacity_hints); h != nullptr;
+            h = h->next) {
+        const size_t peak = atomic_load(&h->peak);
+        const size_t capacity = peak != 0 ? peak : atomic_load(&h->loaded);
+
+        /* A name with a newline could not be read back. */
+        if (capacity != 0 && strchr(h->name, '\n') == nullptr) {
+            fprintf(stream, "%zu %s\n", capacity, h->name);
+        }
+    }
+
+    const bool ok = !ferror(stream);
+
+    return fclose(stream) == 0 && ok;
+#else
+    (void) path;
+    return false;
+#endif
+}
+
+#ifdef ARENA_REGISTRY
+static void capacity_save_at_exit(void)
+{
+    arena_capacity_save(capacity_path);
+}
+#endif
+
+bool arena_capacity_save_at_exit(const char *path)
+{
+#ifdef ARENA_REGISTRY
+    const size_t len = strlen(path) + 1;
+    char *const copy = malloc(len);
+
+    if (copy == nullptr) {
+        return false;
+    }
+
+    memcpy(copy, path, len);
+
+    if (capacity_path == nullptr && atexit(capacity_save_at_exit) != 0) {
+        free(copy);
+        return false;
+    }
+
+    free(capacity_path);
+    capacity_path = copy;
+    return true;
+#else
+    (void) path;
+    return false;
+#endif
+}
+
+#ifdef ARENA_PROFILE
+static Profile *profile_new(size_t cap)
+{
+    Profile *const profile = calloc(1, sizeof *profile + cap * sizeof (Site));
+
+    if (profile != nullptr) {
+        profile->cap = cap;
+    }
+
+    return profile;
+}
+
+static Site *profile_slot(Profile *profile, const char *name)
+{
+    const size_t mask = profile->cap - 1;
+    size_t i = (size_t) (((uintptr_t) name >> 3) * 0x9E3779B97F4A7C15u) & mask;
+
+    while (profile->sites[i].name != nullptr && profile->sites[i].name != name) {
+        i = (i + 1) & mask;
+    }
+
+    return &profile->sites[i];
+}
+
+/* Attributes an allocation of `size` bytes to `site`. If the table can not 
+ * grow, the allocation is counted as lost instead. */
+static void profile_record(Arena *arena, const char *site, size_t size)
+{
+    Profile *profile = arena->profile;
+
+    if (profile == nullptr || profile->count + 1 > profile->cap / 4 * 3) {
+        Profile *const bigger = 
+            profile_new(profile != nullptr ? profile->cap * 2 : PROFILE_MIN_CAP);
+
+        if (bigger == nullptr) {
+            if (profile != nullptr) {
+                ++profile->lost;
+            }
+            return;
+        }
+
+        if (profile != nullptr) {
+            for (size_t i = 0; i < profile->cap; ++i) {
+                if (profile->sites[i].name != nullptr) {
+                    *profile_slot(bigger, profile->sites[i].name) = 
+                        profile->sites[i];
+                }
+            }
+
+            bigger->count = profile->count;
+            bigger->lost = profile->lost;
+            bigger->on_destroy = profile->on_destroy;
+            free(profile);
+        }
+
+        profile = arena->profile = bigger;
+    }
+
+    Site *const slot = profile_slot(profile, site);
+
+    if (slot->name == nullptr) {
+        slot->name = site;
+        ++profile->count;
+    }
+
+    ++slot->count;
+    slot->bytes += size;
+}
+
+static int site_cmp_name(const void *a, const void *b)
+{
+    return strcmp(((const Site *) a)->name, ((const Site *) b)->name);
+}
+
+static int site_cmp_bytes(const void *a, const void *b)
+{
+    const Site *const x = a;
+    const Site *const y = b;
+
+    if (x->bytes != y->bytes) {
+        return x->bytes < y->bytes ? 1 : -1;
+    }
+
+    return strcmp(x->name, y->name);
+}
+#endif
+
+void *arena_alloc_site(Arena *arena, 
+                       size_t alignment, 
+                       size_t size, 
+                       const char *site)
+{
+    void *const p = arena_alloc(arena, alignment, size);
+
+#ifdef ARENA_PROFILE
+    if (p != nullptr) {
+        profile_record(arena, site, size);
+    }
+#else
+    (void) site;
+#endif
+    return p;
+}
+
+void *arena_allocarray_site(Arena *arena,
+                            size_t alignment,
+                            size_t nmemb,
+                            size_t size,
+                            const char *site)
+{
+    void *const p = arena_allocarray(arena, alignment, nmemb, size);
+
+#ifdef ARENA_PROFILE
+    if (p != nullptr) {
+        profile_record(arena, site, nmemb * size);
+    }
+#else
+    (void) site;
+#endif
+    return p;
+}
+
+bool arena_profile_dump(const Arena *arena, FILE *stream)
+{
+#ifdef ARENA_PROFILE
+    const Profile *const profile = arena->profile;
+    const size_t count = profile != nullptr ? profile->count : 0;
+    Site *const sites = malloc((count != 0 ? count : 1) * sizeof *sites);
+    size_t n = 0;
+    size_t total_count = 0;
+    size_t total_bytes = 0;
+
+    if (sites == nullptr) {
+        return false;
+    }
+
+    for (size_t i = 0; profile != nullptr && i < profile->cap; ++i) {
+        if (profile->sites[i].name != nullptr) {
+            sites[n++] = profile->sites[i];
+        }
+    }
+
+    /* Merge the sites that have the same name at different addresses. */
+    qsort(sites, n, sizeof *sites, site_cmp_name);
+
+    size_t merged = 0;
+
+    for (size_t i = 0; i < n; ++i) {
+        if (merged != 0 && strcmp(sites[merged - 1].name, sites[i].name) == 0) {
+            sites[merged - 1].count += sites[i].count;
+            sites[merged - 1].bytes += sites[i].bytes;
+        } else {
+            sites[merged++] = sites[i];
+        }
+    }
+
+    qsort(sites, merged, sizeof *sites, site_cmp_bytes);
+    fprintf(stream, "%14s %12s %6s  %s\n", "bytes", "allocs", "%", "site");
+
+    for (size_t i = 0; i < merged; ++i) {
+        total_bytes += sites[i].bytes;
+        total_count += sites[i].count;
+    }
+
+    for (size_t i = 0; i < merged; ++i) {
+        fprintf(stream, "%14zu %12zu %6.2f  %s\n", sites[i].bytes, 
+            sites[i].count, 
+            total_bytes != 0 ? 100.0 * sites[i].bytes / total_bytes : 0.0,
+            sites[i].name);
+    }
+
+    fprintf(stream, "%14zu %12zu %6.2f  %s\n", total_bytes, total_count,
+        total_bytes != 0 ? 100.0 : 0.0, "total");
+
+    if (profile != nullptr && profile->lost != 0) {
+        fprintf(stream, "%14s %12zu %6s  %s\n", "-", profile->lost, "-", 
+            "not recorded (out of memory)");
+    }
+
+    free(sites);
+    return true;
+#else
+    (void) arena;
+    (void) stream;
+    return false;
+#endif
+}
+
+bool arena_profile_dump_on_destroy(Arena *arena, FILE *stream)
+{
+#ifdef ARENA_PROFILE
+    if (arena->profile == nullptr) {
+        arena->profile = profile_new(PROFILE_MIN_CAP);
+
+        if (arena->profile == nullptr) {
+            return false;
+        }
+    }
+
+    arena->profile->on_destroy = stream;
+    return true;
+#else
+    (void) arena;
+    (void) stream;
+    return false;
+#endif
+}
+
+/* Returns true if `ptr` is the last allocation made from `arena`, and it is 
+ * `size` bytes long. */
+static bool is_last_alloc(const Arena *arena, const void *ptr, size_t size)
+{
+    const M_Pool *const curr_pool = arena->pools[arena->current - 1];
+
+    return size == arena->last_alloc_size
+        && !arena->last_is_large
+        && arena->last_leftover == nullptr
+        && curr_pool->offset >= size
+        && (const uint8_t *) ptr == curr_pool->buf + curr_pool->offset - size;
+}
+
+void arena_vec_init(ArenaVec *vec, size_t alignment, size_t elem_size)
+{
+/* *INDENT-OFF* */
+    *vec = (ArenaVec) {
+        .elem_size = elem_size,
+        .alignment = alignment,
+    };
+/* *INDENT-ON* */
+}
+
+bool arena_vec_reserve(Arena *arena, ArenaVec *vec, size_t cap)
+{
+    if (cap <= vec->cap) {
+        return true;
+    }
+
+    if (vec->elem_size == 0 || cap > SIZE_MAX / vec->elem_size) {
+        return false;
+    }
+
+    const size_t old_size = vec->cap * vec->elem_size;
+    const size_t new_size = cap * vec->elem_size;
+
+    /* If nothing has been allocated since the array last grew, it sits at the
+     * tail of the current pool and can be extended in place. */
+    if (vec->data != nullptr
+        && is_last_alloc(arena, vec->data, old_size)
+        && arena_realloc(arena, new_size)) {
+        vec->cap = cap;
+        return true;
+    }
+
+    uint8_t *const data = arena_alloc(arena, vec->alignment, new_size);
+
+    if (data == nullptr) {
+        return false;
+    }
+
+    if (vec->len != 0) {
+        memcpy(data, vec->data, vec->len * vec->elem_size);
+    }
+
+    /* The old block is left behind, and is reclaimed with the arena. */
+    vec->data = data;
+    vec->cap = cap;
+    return true;
+}
+
+void *arena_vec_push(Arena *arena, ArenaVec *vec, const void *elem)
+{
+    if (vec->len == vec->cap) {
+        const size_t cap = vec->cap < VEC_MIN_CAP / 2 
+            ? VEC_MIN_CAP 
+            : vec->cap * 2;
+
+        /* Fall back to the exact size when the pool can not hold a doubled 
+         * array, so that a nearly full pool is still usable. */
+        if ((cap <= vec->cap || !arena_vec_reserve(arena, vec, cap))
+            && (vec->len == SIZE_MAX
+                || !arena_vec_reserve(arena, vec, vec->len + 1))) {
+            return nullptr;
+        }
+    }
+
+    uint8_t *const slot = (uint8_t *) vec->data + vec->len * vec->elem_size;
+
+    if (elem != nullptr) {
+        memcpy(slot, elem, vec->elem_size);
+    }
+
+    ++vec->len;
+    return slot;
+}
+
+void *arena_vec_at(const ArenaVec *vec, size_t index)
+{
+    return index < vec->len
+        ? (uint8_t *) vec->data + index * vec->elem_size
+        : nullptr;
+}
+
+static bool str_vappendf(Arena *arena, 
+                         ArenaStr *str, 
+                         const char *restrict fmt, 
+                         va_list ap)
+{
+    va_list ap_copy;
+    int len;
+
+    va_copy(ap_copy, ap);
+
+    M_Pool *const curr_pool = arena->pools[arena->current - 1];
+    const bool in_place = str->data != nullptr 
+        && is_last_alloc(arena, str->data, str->len + 1);
+
+    /* Format straight into the tail of the current pool, after the string if
+     * it is the last allocation, and after a copy of it otherwise. Most of the
+     * time the output fits, and all that is left to do is to commit the bytes
+     * that were written. A block that needs a canary in front of it is not 
+     * formatted in place. */
+    if (in_place 
+        || (canary_lead(curr_pool) == 0 && pool_room(curr_pool) > str->len)) {
+        char *const dst = in_place 
+            ? str->data 
+            : (char *) curr_pool->buf + curr_pool->offset;
+        const size_t avail = in_place 
+            ? pool_room(curr_pool) + 1 
+            : pool_room(curr_pool) - str->len;
+
+        D(debug_tail_open(curr_pool));
+
+        if (!in_place && str->len != 0) {
+            memcpy(dst, str->data, str->len);
+        }
+
+        len = vsnprintf(dst + str->len, avail, fmt, ap);
+
+        if (len >= 0 && (size_t) len < avail) {
+            if (in_place) {
+                D(debug_grow(curr_pool, (uint8_t *) str->data, 
+                             arena->last_alloc_size, 
+                             arena->last_alloc_size + (size_t) len));
+                curr_pool->offset += (size_t) len;
+                arena->last_alloc_size += (size_t) len;
+                commit(arena, (size_t) len, (size_t) len);
+                TRACE(trace_record(arena->trace_id, ARENA_TRACE_REALLOC, true,
+                                   arena->last_alloc_size, 0, 0));
+            } else {
+                const size_t size = str->len + (size_t) len + 1;
+
+                str->data = dst;
+                D(debug_alloc(curr_pool, dst, size));
+                curr_pool->offset += size;
+                arena->last_alloc_size = size;
+                arena->last_is_large = false;
+                arena->last_leftover = nullptr;
+                STATS(++arena->stats.allocs);
+                commit(arena, size, size);
+                TRACE(trace_record(arena->trace_id, ARENA_TRACE_ALLOC, true, 
+                                   1, size, 0));
+            }
+
+            D(debug_tail_close(curr_pool, 0));
+            str->len += (size_t) len;
+            va_end(ap_copy);
+            return true;
+        }
+
+        if (in_place) {
+            str->data[str->len] = '\0';
+        }
+
+        D(debug_tail_close(curr_pool, pool_room(curr_pool)));
+    } else {
+        /* Measure the output first. This takes a second pass, but only when
+         * the current pool can not even hold the string, or when the block
+         * needs a canary. */
+        len = vsnprintf(nullptr, 0, fmt, ap);
+    }
+
+    /* The output does not fit. Copy the string to a block that is large 
+     * enough, in the next pool if need be, and format into it. */
+    if (len < 0 || (size_t) len > SIZE_MAX - str->len - 1) {
+        va_end(ap_copy);
+        return false;
+    }
+
+    char *const data = arena_alloc(arena, 1, str->len + (size_t) len + 1);
+
+    if (data == nullptr) {
+        va_end(ap_copy);
+        return false;
+    }
+
+    if (str->len != 0) {
+        memcpy(data, str->data, str->len);
+    }
+
+    vsnprintf(data + str->len, (size_t) len + 1, fmt, ap_copy);
+    va_end(ap_copy);
+    str->data = data;
+    str->len += (size_t) len;
+    return true;
+}
+
+bool arena_str_append(Arena *arena, ArenaStr *str, const char *s, size_t len)
+{
+    if (len > SIZE_MAX - str->len - 1) {
+        return false;
+    }
+
+    if (str->data != nullptr 
+        && is_last_alloc(arena, str->data, str->len + 1)
+        && arena_realloc(arena, str->len + len + 1)) {
+        memcpy(str->data + str->len, s, len);
+    } else {
+        char *const data = arena_alloc(arena, 1, str->len + len + 1);
+
+        if (data == nullptr) {
+            return false;
+        }
+
+        if (str->len != 0) {
+            memcpy(data, str->data, str->len);
+        }
+
+        memcpy(data + str->len, s, len);
+        str->data = data;
+    }
+
+    str->len += len;
+    str->data[str->len] = '\0';
+    return true;
+}
+
+bool arena_str_appendf(Arena *arena, 
+                       ArenaStr *str, 
+                       const char *restrict fmt, 
+                       ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    const bool ok = str_vappendf(arena, str, fmt, ap);
+
+    va_end(ap);
+    return ok;
+}
+
+char *arena_vsprintf(Arena *arena, const char *restrict fmt, va_list ap)
+{
+    ArenaStr str = { 0 };
+
+    return str_vappendf(arena, &str, fmt, ap) ? str.data : nullptr;
+}
+
+char *arena_sprintf(Arena *arena, const char *restrict fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    char *const s = arena_vsprintf(arena, fmt, ap);
+
+    va_end(ap);
+    return s;
+}
+
+void arena_deque_init(ArenaDeque *deque, 
+                      size_t alignment, 
+                      size_t elem_size, 
+                      size_t chunk_len)
+{
+    if (chunk_len == 0) {
+        chunk_len = elem_size != 0 && elem_size < DEQUE_CHUNK_SIZE 
+            ? DEQUE_CHUNK_SIZE / elem_size 
+            : 1;
+    }
+
+    /* A power of 2 turns the division in arena_deque_at() into a shift. */
+    size_t shift = 0;
+
+    while (shift < sizeof chunk_len * 8 - 1 
+        && ((size_t) 1 << shift) < chunk_len) {
+        ++shift;
+    }
+
+/* *INDENT-OFF* */
+    *deque = (ArenaDeque) {
+        .chunk_len = (size_t) 1 << shift,
+        .chunk_shift = shift,
+        .elem_size = elem_size,
+        .alignment = alignment,
+    };
+/* *INDENT-ON* */
+}
+
+/* Moves the chunk pointers of `deque` to a map twice as large, with the chunks
+ * in use in the middle, so that there is room at both ends. The old map is 
+ * left to be reclaimed with the arena. */
+static bool deque_grow_map(Arena *arena, ArenaDeque *deque)
+{
+    const size_t cap = deque->map_cap < DEQUE_MIN_MAP_CAP / 2
+        ? DEQUE_MIN_MAP_CAP 
+        : deque->map_cap * 2;
+
+    if (cap <= deque->map_cap) {
+        return false;
+    }
+
+    void **const chunks = 
+        arena_allocarray(arena, ALIGNOF(void *), cap, sizeof *chunks);
+
+    if (chunks == nullptr) {
+        return false;
+    }
+
+    const size_t first = (cap - deque->nchunks) / 2;
+
+    for (size_t i = 0; i < cap; ++i) {
+        chunks[i] = nullptr;
+    }
+
+    for (size_t i = 0; i < deque->nchunks; ++i) {
+        chunks[first + i] = deque->chunks[deque->first + i];
+    }
+
+    deque->chunks = chunks;
+    deque->map_cap = cap;
+    deque->first = first;
+    return true;
+}
+
+/* Makes sure that map slot `i` has a chunk. A chunk that was left there by a 
+ * pop is reused. */
+static bool deque_fill_slot(Arena *arena, ArenaDeque *deque, size_t i)
+{
+    if (deque->chunks[i] == nullptr) {
+        deque->chunks[i] = arena_allocarray(arena, deque->alignment, 
+                                            deque->chunk_len, 
+                                            deque->elem_size);
+    }
+
+    return deque->chunks[i] != nullptr;
+}
+
+void *arena_deque_push_back(Arena *arena, ArenaDeque *deque, const void *elem)
+{
+    const size_t pos = deque->head + deque->len;
+
+    if (pos >> deque->chunk_shift == deque->nchunks) {
+        if (deque->first + deque->nchunks == deque->map_cap
+            && !deque_grow_map(arena, deque)) {
+            return nullptr;
+        }
+
+        if (!deque_fill_slot(arena, deque, deque->first + deque->nchunks)) {
+            return nullptr;
+        }
+
+        ++deque->nchunks;
+    }
+
+    ++deque->len;
+
+    void *const slot = arena_deque_at(deque, deque->len - 1);
+
+    if (elem != nullptr) {
+        memcpy(slot, elem, deque->elem_size);
+    }
+
+    return slot;
+}
+
+void *arena_deque_push_front(Arena *arena, ArenaDeque *deque, const void *elem)
+{
+    if (deque->head == 0) {
+        if (deque->first == 0 && !deque_grow_map(arena, deque)) {
+            return nullptr;
+        }
+
+        if (!deque_fill_slot(arena, deque, deque->first - 1)) {
+            return nullptr;
+        }
+
+        --deque->first;
+        ++deque->nchunks;
+        deque->head = deque->chunk_len;
+    }
+
+    --deque->head;
+    ++deque->len;
+
+    void *const slot = arena_deque_at(deque, 0);
+
+    if (elem != nullptr) {
+        memcpy(slot, elem, deque->elem_size);
+    }
+
+    return slot;
+}
+
+void *arena_deque_pop_back(ArenaDeque *deque)
+{
+    if (deque->len == 0) {
+        return nullptr;
+    }
+
+    void *const slot = arena_deque_at(deque, deque->len - 1);
+
+    --deque->len;
+
+    /* Keep the emptied chunk in the map for the next push. */
+    if (((deque->head + deque->len) & (deque->chunk_len - 1)) == 0) {
+        --deque->nchunks;
+    }
+
+    return slot;
+}
+
+void *arena_deque_pop_front(ArenaDeque *deque)
+{
+    if (deque->len == 0) {
+        return nullptr;
+    }
+
+    void *const slot = arena_deque_at(deque, 0);
+
+    --deque->len;
+
+    if (++deque->head == deque->chunk_len) {
+        ++deque->first;
+        --deque->nchunks;
+        deque->head = 0;
+    }
+
+    return slot;
+}
+
+void *arena_deque_at(const ArenaDeque *deque, size_t index)
+{
+    if (index >= deque->len) {
+        return nullptr;
+    }
+
+    const size_t pos = deque->head + index;
+    uint8_t *const chunk = 
+        deque->chunks[deque->first + (pos >> deque->chunk_shift)];
+
+    return chunk + (pos & (deque->chunk_len - 1)) * deque->elem_size;
+}
+
+void *arena_deque_chunk(const ArenaDeque *deque, size_t index, size_t *len)
+{
+    if (deque->len == 0 || index >= deque->nchunks) {
+        *len = 0;
+        return nullptr;
+    }
+
+    const size_t begin = index == 0 ? deque->head : 0;
+    const size_t end = index == deque->nchunks - 1 
+        ? deque->head + deque->len - (index << deque->chunk_shift)
+        : deque->chunk_len;
+
+    *len = end - begin;
+    return (uint8_t *) deque->chunks[deque->first + index] 
+        + begin * deque->elem_size;
+}
+
+/* 64-bit hash of `len` bytes at `data`. Reads 8 bytes at a time, and finishes
+ * with the MurmurHash3 finalizer to spread the bits over the whole word. */
+static uint64_t hash_bytes(const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    uint64_t h = 0x9E3779B97F4A7C15u ^ len;
+
+    for (; len >= 8; len -= 8, p += 8) {
+        uint64_t k;
+
+        memcpy(&k, p, sizeof k);
+        h = (h ^ k * 0xBF58476D1CE4E5B9u) * 0x94D049BB133111EBu;
+        h ^= h >> 31;
+    }
+
+    uint64_t k = 0;
+
+    for (size_t i = 0; i < len; ++i) {
+        k |= (uint64_t) p[i] << (8 * i);
+    }
+
+    h ^= k * 0xBF58476D1CE4E5B9u;
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDu;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53u;
+    h ^= h >> 33;
+    return h;
+}
+
+ATTRIB_INLINE ATTRIB_CONST static inline uint8_t ctrl_tag(uint64_t hash)
+{
+    return (uint8_t) (hash >> 57);
+}
+
+/* A group of GROUP_WIDTH control bytes. The matches of a group are returned
+ * as a GroupMask, which group_mask_next() turns into slot indices. */
+#if defined(GROUP_SSE2)
+
+/* One bit per slot, from _mm_movemask_epi8(). */
+typedef __m128i Group;
+typedef uint32_t GroupMask;
+
+ATTRIB_INLINE static inline Group group_load(const uint8_t *ctrl)
+{
+    return _mm_loadu_si128((const __m128i *) ctrl);
+}
+
+ATTRIB_INLINE static inline GroupMask group_match(Group g, uint8_t tag)
+{
+    return (GroupMask) _mm_movemask_epi8(
+        _mm_cmpeq_epi8(g, _mm_set1_epi8((char) tag)));
+}
+
+ATTRIB_INLINE static inline GroupMask group_match_empty(Group g)
+{
+    return (GroupMask) _mm_movemask_epi8(
+        _mm_cmpeq_epi8(g, _mm_set1_epi8((char) CTRL_EMPTY)));
+}
+
+/* Empty and deleted slots are the ones with the high bit set. */
+ATTRIB_INLINE static inline GroupMask group_match_empty_or_deleted(Group g)
+{
+    return (GroupMask) _mm_movemask_epi8(g);
+}
+
+ATTRIB_INLINE static inline size_t group_mask_next(GroupMask *mask)
+{
+    size_t i = 0;
+
+    #if defined(__GNUC__) || defined(__clang__)
+        i = (size_t) __builtin_ctz(*mask);
+    #else
+        while (!(*mask & ((GroupMask) 1 << i))) {
+            ++i;
+        }
+    #endif
+
+    *mask &= *mask - 1;
+    return i;
+}
+
+#else
+
+/* The high bit set in every matching byte. */
+typedef uint64_t GroupMask;
+
+#if defined(GROUP_NEON)
+
+typedef uint8x8_t Group;
+
+ATTRIB_INLINE static inline Group group_load(const uint8_t *ctrl)
+{
+    return vld1_u8(ctrl);
+}
+
+ATTRIB_INLINE static inline GroupMask group_match(Group g, uint8_t tag)
+{
+    return vget_lane_u64(vreinterpret_u64_u8(vceq_u8(g, vdup_n_u8(tag))), 0)
+        & 0x8080808080808080u;
+}
+
+ATTRIB_INLINE static inline GroupMask group_match_empty(Group g)
+{
+    return group_match(g, CTRL_EMPTY);
+}
+
+ATTRIB_INLINE static inline GroupMask group_match_empty_or_deleted(Group g)
+{
+    return vget_lane_u64(vreinterpret_u64_u8(g), 0) & 0x8080808080808080u;
+}
+
+#else
+
+typedef uint64_t Group;
+
+ATTRIB_INLINE static inline Group group_load(const uint8_t *ctrl)
+{
+    Group g = 0;
+
+    /* Compiles to a single load on little-endian targets, and keeps byte i of
+     * the group in bits [8i, 8i + 8) everywhere else. */
+    for (size_t i = 0; i < GROUP_WIDTH; ++i) {
+        g |= (Group) ctrl[i] << (8 * i);
+    }
+
+    return g;
+}
+
+ATTRIB_INLINE ATTRIB_CONST static inline GroupMask group_match(Group g, 
+                                                               uint8_t tag)
+{
+    const Group x = g ^ (0x0101010101010101u * tag);
+
+    /* May report a false positive in a byte following a true match, which the
+     * caller weeds out when comparing keys. */
+    return (x - 0x0101010101010101u) & ~x & 0x8080808080808080u;
+}
+
+/* CTRL_EMPTY is the only control byte with the high bit set and bit 1 
+ * clear. */
+ATTRIB_INLINE ATTRIB_CONST static inline GroupMask group_match_empty(Group g)
+{
+    return g & ~(g << 6) & 0x8080808080808080u;
+}
+
+ATTRIB_INLINE ATTRIB_CONST static inline GroupMask 
+group_match_empty_or_deleted(Group g)
+{
+    return g & 0x8080808080808080u;
+}
+
+#endif
+
+ATTRIB_INLINE static inline size_t group_mask_next(GroupMask *mask)
+{
+    size_t i = 0;
+
+    #if defined(__GNUC__) || defined(__clang__)
+        i = (size_t) __builtin_ctzll(*mask) / 8;
+    #else
+        while (!(*mask & ((GroupMask) 0x80 << (8 * i)))) {
+            ++i;
+        }
+    #endif
+
+    *mask &= *mask - 1;
+    return i;
+}
+
+#endif
+
+/* Returns the smallest power of 2, no less than TABLE_MIN_CAP, that holds 
+ * `count` entries at a load factor of at most 3/4, or 0 on overflow. */
+static size_t table_cap_for(size_t count)
+{
+    if (count > SIZE_MAX / 4) {
+        return 0;
+    }
+
+    size_t cap = TABLE_MIN_CAP;
+
+    while (cap / 4 * 3 < count) {
+        if (cap > SIZE_MAX / 2) {
+            return 0;
+        }
+        cap *= 2;
+    }
+
+    return cap;
+}
+
+typedef struct intern_entry {
+    uint64_t hash;
+    size_t len;
+    const char *str;
+} Intern_Entry;
+
+struct arena_intern {
+    size_t count;
+    size_t cap;
+    uint8_t *ctrl;
+    Intern_Entry *entries;
+};
+
+/* Returns the slot of the string `s` of `len` bytes with hash `hash` in 
+ * `table`, or the empty slot where it would be inserted. */
+static size_t intern_probe(const ArenaIntern *table,
+                           const char *s,
+                           size_t len,
+                           uint64_t hash,
+                           bool *found)
+{
+    const size_t group_mask = table->cap / GROUP_WIDTH - 1;
+    const uint8_t tag = ctrl_tag(hash);
+
+    for (size_t g = hash & group_mask;; g = (g + 1) & group_mask) {
+        const size_t base = g * GROUP_WIDTH;
+        const Group group = group_load(table->ctrl + base);
+
+        for (GroupMask m = group_match(group, tag); m != 0;) {
+            const size_t i = base + group_mask_next(&m);
+            const Intern_Entry *const e = &table->entries[i];
+
+            if (table->ctrl[i] == tag && e->hash == hash && e->len == len
+                && memcmp(e->str, s, len) == 0) {
+                *found = true;
+                return i;
+            }
+        }
+
+        GroupMask empty = group_match_empty(group);
+
+        /* The load factor guarantees an empty slot somewhere. */
+        if (empty != 0) {
+            *found = false;
+            return base + group_mask_next(&empty);
+        }
+    }
+}
+
+static bool intern_alloc_slots(Arena *arena, ArenaIntern *table, size_t cap)
+{
+    uint8_t *const ctrl = arena_alloc(arena, 1, cap);
+
+    if (ctrl == nullptr) {
+        return false;
+    }
+
+    Intern_Entry *const entries = 
+        arena_allocarray(arena, ALIGNOF(Intern_Entry), cap, sizeof *entries);
+
+    if (entries == nullptr) {
+        return false;
+    }
+
+    memset(ctrl, CTRL_EMPTY, cap);
+    table->ctrl = ctrl;
+    table->entries = entries;
+    table->cap = cap;
+    return true;
+}
+
+ArenaIntern *arena_intern_new(Arena *arena, size_t capacity)
+{
+    const size_t cap = table_cap_for(capacity);
+
+    if (cap == 0) {
+        return nullptr;
+    }
+
+    ArenaIntern *const table = 
+        arena_alloc(arena, ALIGNOF(ArenaIntern), sizeof *table);
+
+    if (table == nullptr || !intern_alloc_slots(arena, table, cap)) {
+        return nullptr;
+    }
+
+    table->count = 0;
+    return table;
+}
+
+/* Moves the entries of `table` to slots twice as many. The old slots are left 
+ * to be reclaimed with the arena. */
+static bool intern_grow(Arena *arena, ArenaIntern *table)
+{
+    if (table->cap > SIZE_MAX / 2) {
+        return false;
+    }
+
+    ArenaIntern old = *table;
+
+    if (!intern_alloc_slots(arena, table, old.cap * 2)) {
+        *table = old;
+        return false;
+    }
+
+    for (size_t i = 0; i < old.cap; ++i) {
+        if (old.ctrl[i] != CTRL_EMPTY) {
+            const Intern_Entry *const e = &old.entries[i];
+            bool found;
+            const size_t slot = 
+                intern_probe(table, e->str, e->len, e->hash, &found);
+
+            table->ctrl[slot] = old.ctrl[i];
+            table->entries[slot] = *e;
+        }
+    }
+
+    return true;
+}
+
+const char *arena_intern_find(const ArenaIntern *table, 
+                              const char *s, 
+                              size_t len)
+{
+    bool found;
+    const size_t slot = 
+        intern_probe(table, s, len, hash_bytes(s, len), &found);
+
+    return found ? table->entries[slot].str : nullptr;
+}
+
+const char *arena_intern(Arena *arena, 
+                         ArenaIntern *table, 
+                         const char *s, 
+                         size_t len)
+{
+    if (len == SIZE_MAX) {
+        return nullptr;
+    }
+
+    const uint64_t hash = hash_bytes(s, len);
+    bool found;
+    size_t slot = intern_probe(table, s, len, hash, &found);
+
+    if (found) {
+        return table->entries[slot].str;
+    }
+
+    if (table->count + 1 > table->cap / 4 * 3) {
+        if (!intern_grow(arena, table)) {
+            return nullptr;
+        }
+        slot = intern_probe(table, s, len, hash, &found);
+    }
+
+    char *const str = arena_alloc(arena, 1, len + 1);
+
+    if (str == nullptr) {
+        return nullptr;
+    }
+
+    memcpy(str, s, len);
+    str[len] = '\0';
+
+/* *INDENT-OFF* */
+    table->ctrl[slot] = ctrl_tag(hash);
+    table->entries[slot] = (Intern_Entry) {
+        .hash = hash,
+        .len = len,
+        .str = str,
+    };
+/* *INDENT-ON* */
+    ++table->count;
+    return str;
+}
+
+size_t arena_intern_count(const ArenaIntern *table)
+{
+    return table->count;
+}
+
+/* The slots and the control bytes of a map share one block: 
+ *
+ *      [slot 0][slot 1]...[slot cap - 1][ctrl 0][ctrl 1]...[ctrl cap - 1]
+ *
+ * A slot holds a key, followed by its value at `value_offset`. */
+struct arena_map {
+    size_t count;
+    size_t deleted;
+    size_t cap;
+    size_t key_size;
+    size_t value_size;
+    size_t value_offset;
+    size_t slot_size;
+    size_t alignment;
+    uint8_t *slots;
+    uint8_t *ctrl;
+};
+
+/* Returns the size of the block that holds `cap` slots of `map`, or 0 on 
+ * overflow. */
+static size_t map_block_size(const ArenaMap *map, size_t cap)
+{
+    if (cap > (SIZE_MAX - map->alignment) / (map->slot_size + 1)) {
+        return 0;
+    }
+
+    return round_up(cap * (map->slot_size + 1), map->alignment);
+}
+
+/* Returns the slot of `key` with hash `hash` in `map`. If `key` is not 
+ * present, returns the slot where it would be inserted instead, and sets 
+ * `*found` to false. */
+static size_t map_probe(const ArenaMap *map, 
+                        const void *key, 
+                        uint64_t hash, 
+                        bool *found)
+{
+    const size_t group_mask = map->cap / GROUP_WIDTH - 1;
+    const uint8_t tag = ctrl_tag(hash);
+    size_t insert = SIZE_MAX;
+
+    for (size_t g = hash & group_mask;; g = (g + 1) & group_mask) {
+        const size_t base = g * GROUP_WIDTH;
+        const Group group = group_load(map->ctrl + base);
+
+        for (GroupMask m = group_match(group, tag); m != 0;) {
+            const size_t i = base + group_mask_next(&m);
+
+            if (map->ctrl[i] == tag
+                && memcmp(map->slots + i * map->slot_size, key, 
+                          map->key_size) == 0) {
+                *found = true;
+                return i;
+            }
+        }
+
+        GroupMask free_slots = group_match_empty_or_deleted(group);
+
+        if (insert == SIZE_MAX && free_slots != 0) {
+            insert = base + group_mask_next(&free_slots);
+        }
+
+        /* A key is never stored past an empty slot in its probe sequence. The
+         * load factor guarantees an empty slot somewhere. */
+        if (group_match_empty(group) != 0) {
+            *found = false;
+            return insert;
+        }
+    }
+}
+
+/* Points `map` at the `cap` slots in `block`, and marks all of them empty. */
+static void map_set_block(ArenaMap *map, uint8_t *block, size_t cap)
+{
+    map->slots = block;
+    map->ctrl = block + cap * map->slot_size;
+    map->cap = cap;
+    map->deleted = 0;
+    memset(map->ctrl, CTRL_EMPTY, cap);
+}
+
+/* Moves every entry of `old` into the empty table `map`. */
+static void map_rehash(ArenaMap *map, const ArenaMap *old)
+{
+    for (size_t i = 0; i < old->cap; ++i) {
+        if (old->ctrl[i] & 0x80) {
+            continue;
+        }
+
+        const uint8_t *const slot = old->slots + i * old->slot_size;
+        bool found;
+        const size_t j = 
+            map_probe(map, slot, hash_bytes(slot, map->key_size), &found);
+
+        map->ctrl[j] = old->ctrl[i];
+        memcpy(map->slots + j * map->slot_size, slot, map->slot_size);
+    }
+}
+
+ArenaMap *arena_map_new(Arena *arena,
+                        size_t alignment,
+                        size_t key_size,
+                        size_t value_size,
+                        size_t capacity)
+{
+    if (key_size == 0 || alignment == 0 
+        || (alignment != 1 && !is_power_of_two(alignment))) {
+        return nullptr;
+    }
+
+    const size_t cap = table_cap_for(capacity);
+
+    if (cap == 0 
+        || key_size > SIZE_MAX / 4 || value_size > SIZE_MAX / 4
+        || alignment > SIZE_MAX / 4) {
+        return nullptr;
+    }
+
+    ArenaMap *const map = arena_alloc(arena, ALIGNOF(ArenaMap), sizeof *map);
+
+    if (map == nullptr) {
+        return nullptr;
+    }
+
+    const size_t value_offset = round_up(key_size, alignment);
+
+/* *INDENT-OFF* */
+    *map = (ArenaMap) {
+        .key_size = key_size,
+        .value_size = value_size,
+        .value_offset = value_offset,
+        .slot_size = round_up(value_offset + value_size, alignment),
+        .alignment = alignment,
+    };
+/* *INDENT-ON* */
+
+    const size_t size = map_block_size(map, cap);
+    uint8_t *const block = 
+        size != 0 ? arena_alloc(arena, alignment, size) : nullptr;
+
+    if (block == nullptr) {
+        return nullptr;
+    }
+
+    map_set_block(map, block, cap);
+    return map;
+}
+
+/* Rehashes `map` into a table of `cap` slots.
+ *
+ * If the table is the last allocation in the current pool, it is extended in 
+ * place to hold the new table right after the old one. Once the entries have
+ * been moved over, the new table slides down to the start of the block, and 
+ * the block shrinks to the new table's size. Otherwise, the new table goes in
+ * a new block, and the old one is left to be reclaimed with the arena. */
+static bool map_resize(Arena *arena, ArenaMap *map, size_t cap)
+{
+    const size_t old_size = map_block_size(map, map->cap);
+    const size_t new_size = map_block_size(map, cap);
+
+    if (new_size == 0 || new_size > SIZE_MAX - old_size) {
+        return false;
+    }
+
+    const ArenaMap old = *map;
+
+    if (is_last_alloc(arena, old.slots, old_size)
+        && arena_realloc(arena, old_size + new_size)) {
+        map_set_block(map, old.slots + old_size, cap);
+        map_rehash(map, &old);
+        memmove(old.slots, map->slots, new_size);
+        map->slots = old.slots;
+        map->ctrl = old.slots + cap * map->slot_size;
+        arena_realloc(arena, new_size);
+        return true;
+    }
+
+    uint8_t *const block = arena_alloc(arena, map->alignment, new_size);
+
+    if (block == nullptr) {
+        return false;
+    }
+
+    map_set_block(map, block, cap);
+    map_rehash(map, &old);
+    return true;
+}
+
+void *arena_map_get(const ArenaMap *map, const void *key)
+{
+    bool found;
+    const size_t i = 
+        map_probe(map, key, hash_bytes(key, map->key_size), &found);
+
+    return found ? map->slots + i * map->slot_size + map->value_offset 
+                 : nullptr;
+}
+
+void *arena_map_put(Arena *arena, 
+                    ArenaMap *map, 
+                    const void *key, 
+                    const void *value)
+{
+    const uint64_t hash = hash_bytes(key, map->key_size);
+    bool found;
+    size_t i = map_probe(map, key, hash, &found);
+
+    if (!found) {
+        /* Tombstones count towards the load factor, as they lengthen probe 
+         * sequences just the same. Rehash them away at the same size if they
+         * make up a good part of the table. */
+        if (map->count + map->deleted + 1 > map->cap / 4 * 3) {
+            const size_t cap = map->deleted >= map->cap / 4 
+                ? map->cap 
+                : map->cap * 2;
+
+            if (!map_resize(arena, map, cap)) {
+                return nullptr;
+            }
+
+            i = map_probe(map, key, hash, &found);
+        }
+
+        if (map->ctrl[i] == CTRL_DELETED) {
+            --map->deleted;
+        }
+
+        map->ctrl[i] = ctrl_tag(hash);
+        memcpy(map->slots + i * map->slot_size, key, map->key_size);
+        ++map->count;
+    }
+
+    uint8_t *const slot_value = 
+        map->slots + i * map->slot_size + map->value_offset;
+
+    if (value != nullptr && map->value_size != 0) {
+        memcpy(slot_value, value, map->value_size);
+    }
+
+    return slot_value;
+}
+
+bool arena_map_remove(ArenaMap *map, const void *key)
+{
+    bool found;
+    const size_t i = 
+        map_probe(map, key, hash_bytes(key, map->key_size), &found);
+
+    if (!found) {
+        return false;
+    }
+
+    /* A slot can go straight back to empty if no probe sequence has ever gone
+     * past its group, i.e. the group still has an empty slot. */
+    const size_t base = i / GROUP_WIDTH * GROUP_WIDTH;
+
+    if (group_match_empty(group_load(map->ctrl + base)) != 0) {
+        map->ctrl[i] = CTRL_EMPTY;
+    } else {
+        map->ctrl[i] = CTRL_DELETED;
+        ++map->deleted;
+    }
+
+    --map->count;
+    return true;
+}
+
+bool arena_map_next(const ArenaMap *map, 
+                    size_t *iter, 
+                    void **key, 
+                    void **value)
+{
+    for (size_t i = *iter; i < map->cap; ++i) {
+        if (!(map->ctrl[i] & 0x80)) {
+            uint8_t *const slot = map->slots + i * map->slot_size;
+
+            if (key != nullptr) {
+                *key = slot;
+            }
+
+            if (value != nullptr) {
+                *value = slot + map->value_offset;
+            }
+
+            *iter = i + 1;
+            return true;
+        }
+    }
+
+    *iter = map->cap;
+    return false;
+}
+
+size_t arena_map_count(const ArenaMap *map)
+{
+    return map->count;
 }
 
 #undef ATTRIB_CONST
+#undef ATTRIB_PURE
 #undef ATTRIB_MALLOC
 #undef ATTRIB_NONNULL
 #undef ATTRIB_NONNULLEX
 #undef ATTRIB_INLINE
+#undef ATTRIB_PRINTF
 #undef nullptr
 #undef DEFAULT_BUF_CAP
 #undef INITIAL_MPOOL_COUNT
+#undef ALIGNOF
+#undef VEC_MIN_CAP
+#undef DEQUE_CHUNK_SIZE
+#undef DEQUE_MIN_MAP_CAP
+#undef GROUP_WIDTH
+#undef CTRL_EMPTY
+#undef CTRL_DELETED
+#undef GROUP_SSE2
+#undef GROUP_NEON
+#undef TABLE_MIN_CAP
+#undef PROFILE_MIN_CAP
+#undef REGISTRY_NAME_MAX
+#undef CAPACITY_SLACK_SHIFT
+#undef LEFTOVER_BUCKETS
+#undef LEFTOVER_MIN_SHIFT
+#undef TAIL_CHECK_SIZE
+#undef CANARY_SIZE
+#undef CANARY_MIN_CAP
+#undef TRACE_MAGIC
+#undef TRACE_MAGIC_LEN
+#undef TRACE_FAILED
+#undef TRACE_RECORD_MAX
 #undef D
+#undef HAVE_ASAN
+#undef HAVE_VALGRIND
+#undef POISON
+#undef UNPOISON
+#undef VG
+#undef STATS
+#undef TRACE
+#undef REGISTRY
+#undef PROBE3
+#undef PROBE4
@@ -9,19 +9,26 @@
     #define ATTRIB_NONNULL          __attribute__((nonnull))
     #define ATTRIB_NONNULLEX(...)   __attribute__((nonnull(__VA_ARGS__)))
     #define ATTRIB_INLINE           __attribute__((always_inline))
+    #define ATTRIB_PRINTF(fmt, va)  __attribute__((format(printf, fmt, va)))
 #else
     #define ATTRIB_CONST            /**/
+    #define ATTRIB_PURE             /**/
     #define ATTRIB_MALLOC           /**/
     #define ATTRIB_NONNULL          /**/
     #define ATTRIB_NONNULLEX(...)   /**/
     #define ATTRIB_INLINE           /**/
+    #define ATTRIB_PRINTF(fmt, va)  /**/
 #endif
 /* *INDENT-ON* */
 
 #define DEFAULT_BUF_CAP     256 * (size_t)1024
+#define ARENA_LARGE_THRESHOLD   (64 * (size_t)1024)
 
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 
 /* Bump allocator arena. */
 typedef struct arena Arena;
@@ -39,6 +46,44 @@ typedef struct arena Arena;
  * undefined behavior. */
 Arena *arena_new(void *buf, size_t capacity);
 
+/* An upstream allocator, which an arena takes its pools, its metadata, and the
+ * buffers of its large blocks from, instead of the C allocator. `ctx` is 
+ * passed to each function as is.
+ *
+ * `alloc` returns a block of `size` bytes aligned for any object, or `nullptr`
+ * on failure. The block need not be zeroed. `free` releases a block, and is 
+ * given the size it was allocated with. `resize` moves or resizes a block to 
+ * `new_size` bytes, preserving its contents as `realloc()` does. It may be 
+ * `nullptr`, in which case a new block is allocated, and the old one copied 
+ * and freed. */
+typedef struct arena_allocator {
+    void *(*alloc)(void *ctx, size_t size);
+    void (*free)(void *ctx, void *ptr, size_t size);
+    void *(*resize)(void *ctx, void *ptr, size_t old_size, size_t new_size);
+    void *ctx;
+} ArenaAllocator;
+
+/* Equivalent to `arena_new()`, but `arena` allocates from `allocator`, which 
+ * is copied, for as long as it lives. The guard pages of `ARENA_GUARD` are 
+ * only used with the C allocator.
+ *
+ * Returns `nullptr` if `alloc` or `free` is `nullptr`, or on allocation 
+ * failure. */
+Arena *arena_new_with(const ArenaAllocator *allocator, 
+                      void *buf, 
+                      size_t capacity) ATTRIB_NONNULLEX(1);
+
+/* Returns a new arena with the specified `capacity`, as `arena_new()` would, 
+ * but whose memory is allocated from `parent`, or, once `parent` is full, 
+ * from the upstream allocator of `parent`. Resetting the child only touches 
+ * the child.
+ *
+ * Resetting or destroying `parent` destroys its children first, and with 
+ * them, theirs. `parent` may be moved by `arena_resize()` meanwhile.
+ *
+ * Returns `nullptr` on allocation failure. */
+Arena *arena_new_child(Arena *parent, size_t capacity) ATTRIB_NONNULL;
+
 /* Destroys `arena`, freeing all the memory associated with it.
  *
  * Any pointer allocated by this arena is invalidated after this call. */
@@ -51,6 +96,19 @@ void arena_destroy(Arena *arena) ATTRIB_NONNULL;
  * using them * would invoke Undefined Behavior. */
 void arena_reset(Arena *arena) ATTRIB_NONNULL;
 
+/* Resets `arena` like `arena_reset()`, and if it has more than one pool, 
+ * replaces them with a single one, so that the next cycle runs in one 
+ * contiguous region.
+ *
+ * If `slack` is greater than 0, the pool is sized to the bytes that were used
+ * from the pools before the reset, times `slack`. Else it is sized to the sum
+ * of their capacities. It is never smaller than the first pool.
+ *
+ * Returns `false`, and leaves the pools as they are, if the new pool could not
+ * be allocated, or if a pool uses a buffer supplied by the caller. The arena
+ * is reset either way. */
+bool arena_reset_consolidate(Arena *arena, double slack) ATTRIB_NONNULL;
+
 /* Allocates a pointer from `arena`.
  *
  * The allocated pointer is at least aligned to `alignment`.
@@ -59,6 +117,17 @@ void arena_reset(Arena *arena) ATTRIB_NONNULL;
  * 
  * `size` must be a multiple of `alignment`.
  *
+ * Allocations are made from the current pool. If it is full, they are made 
+ * from what was left at the end of the pools before it, if any of that is 
+ * large enough. Failing that, and if there are pools after it that were 
+ * emptied by `arena_reset()`, the next one becomes the current pool.
+ *
+ * If a threshold was set with `arena_set_large_threshold()`, a request of at
+ * least that many bytes that does not fit in the current pool is given a 
+ * buffer of its own instead, sized exactly. It is linked into `arena`
+ * and freed with the pools, and the current pool is left as it is, so that 
+ * the smaller allocations that follow are still made from it.
+ *
  * If a request can not be entertained, i.e. would overflow, or `arena` is full,
  * the function returns `nullptr`. The function also returns a `nullptr` if the 
  * requested `size` or `alignment` is 0 or if `alignment` is not a power of 2, 
@@ -70,7 +139,29 @@ void arena_reset(Arena *arena) ATTRIB_NONNULL;
 void *arena_alloc(Arena *arena, size_t alignment, size_t size)
     ATTRIB_MALLOC ATTRIB_NONNULL;
 
-/* Adds a new memory pool to the existing arena `arena`.
+/* Allocates a pointer from the end of the current pool of `arena`, growing 
+ * down towards the allocations made by `arena_alloc()`, which grow up. The
+ * arguments are those of `arena_alloc()`.
+ *
+ * The two ends share the free bytes in between, so that long-lived results 
+ * can be allocated from the bottom, and the temporaries of the phase that 
+ * computes them from the top, to be released by `arena_reset_top()` without 
+ * copying the results out. The last allocation from the bottom can still be 
+ * resized by `arena_realloc()`, which does not apply to the top.
+ *
+ * If the current pool can not hold the request, or it is invalid, returns 
+ * `nullptr`. The top never moves to another pool. */
+void *arena_alloc_top(Arena *arena, size_t alignment, size_t size)
+    ATTRIB_MALLOC ATTRIB_NONNULL;
+
+/* Releases every allocation made by `arena_alloc_top()` since `arena` was 
+ * created or last reset, leaving the others alone. `arena_reset()` releases 
+ * both ends. Only the pools that were allocated from at the top are visited,
+ * which is usually just the current one. */
+void arena_reset_top(Arena *arena) ATTRIB_NONNULL;
+
+/* Adds a new memory pool to the existing arena `arena`, and makes it the 
+ * current pool.
  * If `capacity` is 0, a default size of `DEFAULT_BUF_CAP` is used.
  *
  * On allocation failure, or if `buf` is a non-null pointer and `capacity` is 0,
@@ -110,20 +201,274 @@ void *arena_allocarray(Arena *arena,
  * last allocated size, it is shrinked to `size`. Else, it is expanded to `size`
  * bytes.
  *
+ * The last allocated size is the `size` that was passed to `arena_alloc()`, or 
+ * to the last successful call to this function. It does not include any 
+ * padding that was inserted for alignment. After `arena_resize()` or 
+ * `arena_reset()`, there is no last allocation, and the last allocated size is
+ * 0.
+ *
  * Returns `false` if the request can not be entertained, i.e out of memory.
  * Else it returns `true`.
  */
 bool arena_realloc(Arena *arena, size_t size) ATTRIB_NONNULL;
 
+/* Allocation statistics of an arena, collected when the library is built with
+ * `ARENA_STATS` defined. Otherwise, they are not collected, and cost nothing.
+ *
+ * Byte counts are cumulative over the lifetime of the arena, except for 
+ * `bytes_in_use`, which is the number of bytes handed out since the last 
+ * reset, including padding, and `peak_bytes_in_use`, its highest value. */
+typedef struct arena_stats {
+    size_t allocs;              /* Successful allocations. */
+    size_t failures;            /* Allocations and expansions that did not 
+                                   fit. */
+    size_t bytes_requested;     /* Bytes requested by successful allocations 
+                                   and expansions. */
+    size_t bytes_consumed;      /* Bytes requested, plus padding. */
+    size_t padding;             /* Bytes of padding inserted for alignment. */
+    size_t pools_added;         /* Pools added by arena_resize(). */
+    size_t large_allocs;        /* Allocations given a buffer of their own. */
+    size_t leftover_allocs;     /* Allocations made from the tails of earlier 
+                                   pools. */
+    size_t resets;              /* Calls to arena_reset(). */
+    size_t bytes_in_use;
+    size_t peak_bytes_in_use;
+} ArenaStats;
+
+/* Copies the allocation statistics of `arena` to `*stats`.
+ *
+ * Returns `false`, and zeroes `*stats`, if the library was not built with 
+ * `ARENA_STATS` defined. Else returns `true`. */
+bool arena_stats(const Arena *arena, ArenaStats *stats) ATTRIB_NONNULL;
+
+/* Call-site attribution. 
+ *
+ * When the library is built with `ARENA_PROFILE` defined, allocations made 
+ * through `ARENA_ALLOC()` and `ARENA_ALLOCARRAY()` are attributed to the file
+ * and line they were made from, and the bytes and allocations of each site 
+ * are tallied over the lifetime of the arena. `arena_alloc_site()` and 
+ * `arena_allocarray_site()` take a caller-supplied `site` tag instead, which 
+ * must remain valid until the arena is destroyed.
+ *
+ * Otherwise, the macros call `arena_alloc()` and `arena_allocarray()` directly,
+ * and nothing is recorded. */
+#define ARENA_STRINGIFY_(x) #x
+#define ARENA_STRINGIFY(x)  ARENA_STRINGIFY_(x)
+#define ARENA_SITE          __FILE__ ":" ARENA_STRINGIFY(__LINE__)
+
+#ifdef ARENA_PROFILE
+    #define ARENA_ALLOC(arena, alignment, size) \
+        arena_alloc_site((arena), (alignment), (size), ARENA_SITE)
+    #define ARENA_ALLOCARRAY(arena, alignment, nmemb, size) \
+        arena_allocarray_site((arena), (alignment), (nmemb), (size), ARENA_SITE)
+#else
+    #define ARENA_ALLOC(arena, alignment, size) \
+        arena_alloc((arena), (alignment), (size))
+    #define ARENA_ALLOCARRAY(arena, alignment, nmemb, size) \
+        arena_allocarray((arena), (alignment), (nmemb), (size))
+#endif
+
+/* Equivalent to `arena_alloc()`, but attributes the allocation to `site`. */
+void *arena_alloc_site(Arena *arena, 
+                       size_t alignment, 
+                       size_t size, 
+                       const char *site) ATTRIB_MALLOC ATTRIB_NONNULL;
+
+/* Equivalent to `arena_allocarray()`, but attributes the allocation to 
+ * `site`. */
+void *arena_allocarray_site(Arena *arena,
+                            size_t alignment,
+                            size_t nmemb,
+                            size_t size,
+                            const char *site) ATTRIB_MALLOC ATTRIB_NONNULL;
+
+/* Writes a report of the bytes and allocations attributed to each site of 
+ * `arena` to `stream`, largest first.
+ *
+ * Returns `false` if the library was not built with `ARENA_PROFILE` defined, 
+ * or on allocation failure. Else returns `true`. */
+bool arena_profile_dump(const Arena *arena, FILE *stream) ATTRIB_NONNULL;
+
+/* Makes `arena_destroy()` write the report of `arena` to `stream`, or not if 
+ * `stream` is `nullptr`.
+ *
+ * Returns `false` if the library was not built with `ARENA_PROFILE` defined, 
+ * or on allocation failure. Else returns `true`. */
+bool arena_profile_dump_on_destroy(Arena *arena, FILE *stream) 
+    ATTRIB_NONNULLEX(1);
+
+/* Process-wide registry.
+ *
+ * When the library is built with `ARENA_REGISTRY` defined, which implies 
+ * `ARENA_STATS`, arenas created with `arena_new_named()` are tracked in a 
+ * lock-free list until they are destroyed, and `arena_registry_dump()` reports
+ * the pools, reserved, used and peak used bytes of each. 
+ *
+ * Registering and dumping are thread-safe, and a dump may run while other 
+ * threads use, resize or destroy their arenas. It never touches the arenas 
+ * themselves: each publishes its counters to its registry entry as they 
+ * change, and the dump reads them from there. The counters of one arena may 
+ * then be a few operations apart from each other. */
+typedef enum arena_dump_format {
+    ARENA_DUMP_JSON,
+    ARENA_DUMP_PROMETHEUS,      /* Prometheus text exposition format. */
+} ArenaDumpFormat;
+
+/* Equivalent to `arena_new()`, but registers the arena under `name`, which is
+ * copied, and truncated to 63 bytes. Names need not be unique.
+ *
+ * Returns `nullptr` on allocation failure. */
+Arena *arena_new_named(void *buf, size_t capacity, const char *name)
+    ATTRIB_NONNULLEX(3);
+
+/* Writes the statistics of the registered arenas to `stream` in `format`.
+ *
+ * Returns `false` if the library was not built with `ARENA_REGISTRY` defined,
+ * or on a write error. Else returns `true`. */
+bool arena_registry_dump(FILE *stream, ArenaDumpFormat format) ATTRIB_NONNULL;
+
+/* Equivalent to `arena_registry_dump()`, but writes to `buf` as `snprintf()` 
+ * would, truncating the output to `size - 1` bytes and terminating it with a
+ * null byte. `buf` may be `nullptr` if `size` is 0.
+ *
+ * Returns the length of the untruncated output, or 0 if the library was not
+ * built with `ARENA_REGISTRY` defined. */
+size_t arena_registry_dump_buf(char *buf, size_t size, ArenaDumpFormat format);
+
+/* Learned capacities.
+ *
+ * With `ARENA_REGISTRY` defined, the peak usage of the pools of each named 
+ * arena, which leaves out large blocks, is recorded when it is destroyed. 
+ * `arena_capacity_save()` writes the highest peak seen for each name, the live
+ * arenas included, to a text file, one name per line, and 
+ * `arena_capacity_load()` reads one back. Afterwards, `arena_new_named()` with
+ * a `nullptr` `buf` and a `capacity` of 0 sizes the arena to half again the 
+ * peak recorded for its name, if any, so that it needs no arena_resize() even
+ * if it peaks a little higher, but never below `DEFAULT_BUF_CAP`. Loading 
+ * must not race with `arena_new_named()`.
+ *
+ * The functions return `false` if the library was not built with 
+ * `ARENA_REGISTRY` defined. */
+
+/* Reads the capacities in the file at `path`, replacing the ones loaded for 
+ * the same names.
+ *
+ * Returns `false` if the file could not be read, if a line is malformed, or on
+ * allocation failure. The well-formed lines are loaded regardless. */
+bool arena_capacity_load(const char *path) ATTRIB_NONNULL;
+
+/* Writes the capacities learned in this run to the file at `path`, along with
+ * the ones loaded for names that no arena used since.
+ *
+ * Returns `false` on an I/O error. */
+bool arena_capacity_save(const char *path) ATTRIB_NONNULL;
+
+/* Has `arena_capacity_save()` write to `path` when the process exits. A later 
+ * call replaces the path.
+ *
+ * Returns `false` on allocation failure. */
+bool arena_capacity_save_at_exit(const char *path) ATTRIB_NONNULL;
+
+/* Allocation tracing.
+ *
+ * When the library is built with `ARENA_TRACE` defined, calls to `arena_new()`,
+ * `arena_alloc()`, `arena_allocarray()`, `arena_realloc()`, `arena_resize()`,
+ * `arena_reset()`, `arena_reset_consolidate()`, `arena_destroy()`, 
+ * `arena_alloc_top()`, `arena_reset_top()` and `arena_set_large_threshold()` 
+ * made while a trace is being recorded 
+ * are appended to it in a compact binary format, with their arguments and the
+ * time they were made at. The containers record the allocations they make 
+ * through them. The `replay` tool re-executes a trace against the library, 
+ * and reports the time and memory it took.
+ *
+ * Events are written from any thread, and a trace may be started and stopped
+ * while other threads call into the library. Calls that are under way when it
+ * stops may still write to its stream, so it must not be closed until they 
+ * have returned. */
+typedef enum arena_trace_op {
+    ARENA_TRACE_NEW = 1,        /* args: capacity, whether buf was given. */
+    ARENA_TRACE_ALLOC,          /* args: alignment, size. */
+    ARENA_TRACE_ALLOCARRAY,     /* args: alignment, nmemb, size. */
+    ARENA_TRACE_REALLOC,        /* args: size. */
+    ARENA_TRACE_RESIZE,         /* args: capacity, whether buf was given. */
+    ARENA_TRACE_RESET,
+    ARENA_TRACE_DESTROY,
+    ARENA_TRACE_ALLOC_TOP,      /* args: alignment, size. */
+    ARENA_TRACE_RESET_TOP,
+    ARENA_TRACE_SET_LARGE_THRESHOLD,    /* args: threshold. */
+    ARENA_TRACE_RESET_CONSOLIDATE,      /* args: slack, in units of 
+                                           1 / ARENA_TRACE_SLACK_SCALE. */
+} ArenaTraceOp;
+
+/* The slack of `arena_reset_consolidate()` is recorded as an integer, rounded
+ * to the nearest multiple of 1 / ARENA_TRACE_SLACK_SCALE, but at least 1 unit
+ * if it is greater than 0, and 0 if it is not. */
+#define ARENA_TRACE_SLACK_SCALE 1024
+
+typedef struct arena_trace_event {
+    ArenaTraceOp op;
+    bool ok;                    /* Whether the call succeeded. */
+    uint64_t ns;                /* Nanoseconds since the trace started. */
+    uint64_t arena;             /* Id of the arena, 0 if arena_new() failed. */
+    size_t args[3];
+} ArenaTraceEvent;
+
+/* Starts recording a trace to `stream`, which must be opened in binary mode.
+ *
+ * Returns `false` if the library was not built with `ARENA_TRACE` defined, if
+ * a trace is already being recorded, or on a write error. Else returns 
+ * `true`. */
+bool arena_trace_start(FILE *stream) ATTRIB_NONNULL;
+
+/* Stops recording the trace, and flushes its stream. */
+void arena_trace_stop(void);
+
+/* Reads the header of a trace from `stream`.
+ *
+ * Returns `false` if `stream` does not hold a trace. Else returns `true`. */
+bool arena_trace_read_header(FILE *stream) ATTRIB_NONNULL;
+
+/* Reads the next event of a trace from `stream` to `*event`. Unused arguments
+ * are 0.
+ *
+ * Returns 1 on success, 0 at the end of the trace, and -1 if the trace is 
+ * malformed or truncated. */
+int arena_trace_read(FILE *stream, ArenaTraceEvent *event) ATTRIB_NONNULL;
+
+/* Canaries.
+ *
+ * When the library is built with `ARENA_CANARY` defined, a canary word is 
+ * written after each block of a pool, just before the next one, and where it
+ * is recorded. `arena_reset()` and `arena_destroy()` check them all in one 
+ * sweep, and abort with a message if one was overwritten. The last block of 
+ * each pool is not followed by a canary. Blocks allocated from the top have 
+ * one below them instead, which also guards them against the bottom, and 
+ * `arena_reset_top()` checks them before it releases them. The canaries count
+ * as padding. */
+
+/* Returns `false` if a canary of `arena` was overwritten. Else, or if the 
+ * library was not built with `ARENA_CANARY` defined, returns `true`. */
+bool arena_check(const Arena *arena) ATTRIB_PURE ATTRIB_NONNULL;
+
+/* Sets the size from which requests that do not fit in the current pool of 
+ * `arena` are given a buffer of their own, from the heap or the allocator of
+ * `arena`, even if it was created on a buffer supplied by the caller. 
+ * `ARENA_LARGE_THRESHOLD` is a reasonable value. `SIZE_MAX`, the default, 
+ * turns this off, so that such requests fail as the arena is full.
+ *
+ * A block with a buffer of its own can be shrunk or deleted by 
+ * `arena_realloc()` while it is the last allocation, but not expanded. */
+void arena_set_large_threshold(Arena *arena, size_t threshold) ATTRIB_NONNULL;
+
 /* Gets the remaining capacity in the current pool (in bytes). */
 size_t arena_pool_capacity(Arena *arena) ATTRIB_PURE;
 
-/* Calculates the number of bytes currently allocated across all chunks in `arena`.
+/* Returns the number of bytes reserved for all the pools in `arena`, used or 
+ * not, and for the blocks that were given buffers of their own. It does not 
+ * include the size of this arena's metadata. 
  *
- * If you allocate types of different alignments or types with larger-than-typical 
- * alignment in the same arena, some padding bytes might get allocated in the 
- * arena. Those padding bytes will add to this function's resulting sum. The 
- * allocated bytes do not include the size of this arena's metadata. */
+ * The total is kept up to date as pools are added, so this takes constant 
+ * time. */
 size_t arena_allocated_bytes(Arena *arena) ATTRIB_PURE;
 
 /* Calculates the number of bytes requested from the C allocator for this arena. 
@@ -131,4 +476,318 @@ size_t arena_allocated_bytes(Arena *arena) ATTRIB_PURE;
  * metadata. */
 size_t arena_allocated_bytes_including_metadata(Arena *arena) ATTRIB_PURE;
 
+/* Breakdown of one pool of an arena. `used` is the number of bytes handed out 
+ * from it, `padding` included. `abandoned` is the tail left behind when the 
+ * arena moved on to the next pool, if it is too short to be allocated from 
+ * again, and `free` what can still be allocated, including the tail of an 
+ * earlier pool that requests which do not fit in the current one are made 
+ * from. */
+typedef struct arena_pool_info {
+    size_t capacity;
+    size_t used;
+    size_t padding;             /* Bytes of padding inserted for alignment. */
+    size_t abandoned;
+    size_t free;
+} ArenaPoolInfo;
+
+/* Returns the number of pools in `arena`. */
+size_t arena_pool_count(const Arena *arena) ATTRIB_PURE ATTRIB_NONNULL;
+
+/* Copies the breakdown of the pool at `index` (zero-based, in the order the 
+ * pools were added) to `*info`.
+ *
+ * Returns `false` if `index` is out of range. Else returns `true`. */
+bool arena_pool_info(const Arena *arena, size_t index, ArenaPoolInfo *info) 
+    ATTRIB_NONNULL;
+
+/* Returns the fraction of the bytes consumed from the pools of `arena` that 
+ * hold user data, i.e. used bytes less padding, over used plus abandoned 
+ * bytes. Returns 1.0 if nothing has been allocated. */
+double arena_efficiency(const Arena *arena) ATTRIB_PURE ATTRIB_NONNULL;
+
+/* Returns the number of bytes handed out by `arena` since it was created or 
+ * last reset, including the padding inserted for alignment.
+ *
+ * It accounts for `arena_realloc()` expanding, shrinking or deleting the last 
+ * allocation, but not for the unused tails of pools that were left behind for
+ * the next one. The total is kept up to date as allocations are made, so this
+ * takes constant time. */
+size_t arena_used_bytes(const Arena *arena) ATTRIB_PURE ATTRIB_NONNULL;
+
+/* Growable array whose storage lives in an arena.
+ *
+ * The array is freed implicitly when its arena is reset or destroyed. As long 
+ * as nothing else is allocated from the arena in the meantime, the array is 
+ * the last allocation in the current pool and grows in place. Otherwise, its
+ * elements are copied to a larger block, and the old block is left to be
+ * reclaimed with the arena.
+ *
+ * The members can be read directly, but must only be modified through the
+ * functions below. */
+typedef struct arena_vec {
+    void *data;
+    size_t len;
+    size_t cap;
+    size_t elem_size;
+    size_t alignment;
+} ArenaVec;
+
+/* Initializes `vec` as an empty array of elements of `elem_size` bytes, that 
+ * are aligned to `alignment`. No memory is allocated.
+ *
+ * `alignment` and `elem_size` have the same requirements as for 
+ * `arena_alloc()`. */
+void arena_vec_init(ArenaVec *vec, size_t alignment, size_t elem_size) 
+    ATTRIB_NONNULL;
+
+/* Ensures that `vec` can hold at least `cap` elements without growing.
+ *
+ * Returns `false` if the request can not be entertained, i.e. would overflow,
+ * or the current pool of `arena` is full. `vec` is left unchanged in that case.
+ * Else returns `true`. */
+bool arena_vec_reserve(Arena *arena, ArenaVec *vec, size_t cap) ATTRIB_NONNULL;
+
+/* Appends an element to `vec`, growing it geometrically if it is full.
+ *
+ * If `elem` is not `nullptr`, `elem_size` bytes are copied from it into the new
+ * element. Else the new element is left uninitialized.
+ *
+ * Returns a pointer to the new element, or `nullptr` if the array could not 
+ * grow. Pointers to existing elements are invalidated if the array grows. */
+void *arena_vec_push(Arena *arena, ArenaVec *vec, const void *elem)
+    ATTRIB_NONNULLEX(1, 2);
+
+/* Returns a pointer to the element at `index` in `vec`, or `nullptr` if 
+ * `index` is out of bounds. */
+void *arena_vec_at(const ArenaVec *vec, size_t index) ATTRIB_PURE ATTRIB_NONNULL;
+
+/* String builder whose buffer lives in an arena.
+ *
+ * A zero-initialized `ArenaStr` is an empty builder. `data` is `nullptr` until 
+ * something is appended, and is always NUL-terminated afterwards. As long as
+ * nothing else is allocated from the arena in the meantime, the string is 
+ * the last allocation in the current pool, and is appended to in place. 
+ * Otherwise, it is copied to a larger block, and the old block is left to be 
+ * reclaimed with the arena. */
+typedef struct arena_str {
+    char *data;
+    size_t len;
+} ArenaStr;
+
+/* Appends `len` bytes from `s` to `str`.
+ *
+ * Returns `false` if the request can not be entertained, i.e. would overflow,
+ * or `arena` is full. `str` is left unchanged in that case. Else returns 
+ * `true`. */
+bool arena_str_append(Arena *arena, ArenaStr *str, const char *s, size_t len)
+    ATTRIB_NONNULL;
+
+/* Appends the output of formatting `fmt` like `printf()` to `str`.
+ *
+ * The output is written directly at the tail of the current pool, after the 
+ * string or after a copy of it, and only the bytes written are committed. If 
+ * it does not fit, the string is copied to a block large enough to hold it, 
+ * which may be in the next pool, and formatted again. Blocks that need a 
+ * canary are also formatted twice, once to measure the output.
+ *
+ * Returns `false` on an encoding error, or if the request can not be 
+ * entertained, i.e. would overflow, or `arena` is full. `str` is left 
+ * unchanged in that case. Else returns `true`. */
+bool arena_str_appendf(Arena *arena, 
+                       ArenaStr *str, 
+                       const char *restrict fmt, 
+                       ...) ATTRIB_NONNULLEX(1, 2, 3) ATTRIB_PRINTF(3, 4);
+
+/* Formats `fmt` like `printf()` into a new NUL-terminated string allocated from
+ * `arena`. It is equivalent to appending to an empty `ArenaStr` with 
+ * `arena_str_appendf()`.
+ *
+ * Returns `nullptr` on an encoding error, or if `arena` is full. */
+char *arena_sprintf(Arena *arena, const char *restrict fmt, ...) 
+    ATTRIB_NONNULLEX(1, 2) ATTRIB_PRINTF(2, 3);
+
+/* Equivalent to `arena_sprintf()`, but takes a `va_list` instead of a variable
+ * number of arguments. */
+char *arena_vsprintf(Arena *arena, const char *restrict fmt, va_list ap)
+    ATTRIB_NONNULLEX(1, 2) ATTRIB_PRINTF(2, 0);
+
+/* Double-ended queue whose elements live in an arena, and never move.
+ *
+ * Elements are stored in fixed-capacity chunks, allocated from the arena as 
+ * needed, and found through a map of chunk pointers, so pushing at either end
+ * and indexing are O(1). Pointers to elements remain valid until the arena is
+ * reset or destroyed, and the chunks can be scanned as contiguous arrays with
+ * `arena_deque_chunk()`. 
+ *
+ * The members can be read directly, but must only be modified through the
+ * functions below. */
+typedef struct arena_deque {
+    void **chunks;
+    size_t map_cap;
+    size_t first;
+    size_t nchunks;
+    size_t head;
+    size_t len;
+    size_t chunk_len;
+    size_t chunk_shift;
+    size_t elem_size;
+    size_t alignment;
+} ArenaDeque;
+
+/* Initializes `deque` as an empty queue of elements of `elem_size` bytes, that
+ * are aligned to `alignment`, in chunks of `chunk_len` elements, rounded up to
+ * a power of 2. If `chunk_len` is 0, chunks of about 4 KiB are used. No memory
+ * is allocated.
+ *
+ * `alignment` and `elem_size` have the same requirements as for 
+ * `arena_alloc()`. */
+void arena_deque_init(ArenaDeque *deque, 
+                      size_t alignment, 
+                      size_t elem_size, 
+                      size_t chunk_len) ATTRIB_NONNULL;
+
+/* Appends an element to the back of `deque`.
+ *
+ * If `elem` is not `nullptr`, `elem_size` bytes are copied from it into the new
+ * element. Else the new element is left uninitialized.
+ *
+ * Returns a pointer to the new element, or `nullptr` if `arena` is full. */
+void *arena_deque_push_back(Arena *arena, ArenaDeque *deque, const void *elem)
+    ATTRIB_NONNULLEX(1, 2);
+
+/* Prepends an element to the front of `deque`. Otherwise the same as 
+ * `arena_deque_push_back()`. */
+void *arena_deque_push_front(Arena *arena, ArenaDeque *deque, const void *elem)
+    ATTRIB_NONNULLEX(1, 2);
+
+/* Removes the last element of `deque`.
+ *
+ * Returns a pointer to the removed element, which remains valid until the 
+ * next push, or `nullptr` if `deque` is empty. */
+void *arena_deque_pop_back(ArenaDeque *deque) ATTRIB_NONNULL;
+
+/* Removes the first element of `deque`. Otherwise the same as 
+ * `arena_deque_pop_back()`. */
+void *arena_deque_pop_front(ArenaDeque *deque) ATTRIB_NONNULL;
+
+/* Returns a pointer to the element at `index` in `deque`, or `nullptr` if 
+ * `index` is out of bounds. */
+void *arena_deque_at(const ArenaDeque *deque, size_t index) 
+    ATTRIB_PURE ATTRIB_NONNULL;
+
+/* Returns a pointer to the elements of `deque` that are stored contiguously in
+ * its chunk at `index`, and sets `*len` to their count. Chunks are numbered 
+ * from the front, from 0 up to `nchunks - 1`.
+ *
+ * Returns `nullptr`, and sets `*len` to 0, if `index` is out of bounds. */
+void *arena_deque_chunk(const ArenaDeque *deque, size_t index, size_t *len)
+    ATTRIB_NONNULL;
+
+/* String interning table whose strings and slots live in an arena.
+ *
+ * Each distinct string is stored once, so interned strings can be compared by
+ * identity. The table is an open-addressing hash table with a control byte per
+ * slot, which are probed several at a time. It is dropped, along with its 
+ * strings, when its arena is reset or destroyed. When it grows, its slots move
+ * to a larger block, but the strings stay put. */
+typedef struct arena_intern ArenaIntern;
+
+/* Returns a new intern table allocated from `arena`, with room for at least
+ * `capacity` strings before it has to grow.
+ *
+ * Returns `nullptr` if the request can not be entertained, i.e. would 
+ * overflow, or `arena` is full. */
+ArenaIntern *arena_intern_new(Arena *arena, size_t capacity) ATTRIB_NONNULL;
+
+/* Returns the interned copy of the `len` bytes at `s`, copying them into 
+ * `arena` if they have not been interned before.
+ *
+ * The returned pointer is NUL-terminated, and remains valid and the same for 
+ * equal strings until `arena` is reset or destroyed. `s` need not be 
+ * NUL-terminated, and may contain NUL bytes.
+ *
+ * Returns `nullptr` if the string is new and `arena` is full. `arena` must be 
+ * the arena that `table` was allocated from. */
+const char *arena_intern(Arena *arena, 
+                         ArenaIntern *table, 
+                         const char *s, 
+                         size_t len) ATTRIB_NONNULL;
+
+/* Returns the interned copy of the `len` bytes at `s`, or `nullptr` if they 
+ * have not been interned. */
+const char *arena_intern_find(const ArenaIntern *table, 
+                              const char *s, 
+                              size_t len) ATTRIB_PURE ATTRIB_NONNULL;
+
+/* Returns the number of distinct strings in `table`. */
+size_t arena_intern_count(const ArenaIntern *table) ATTRIB_PURE ATTRIB_NONNULL;
+
+/* Hash map whose slots live in an arena.
+ *
+ * Keys and values are fixed-size byte blocks. Keys are hashed and compared 
+ * bytewise, so they must not contain padding bytes of indeterminate value. 
+ * The map is an open-addressing hash table: entries are stored inline in one
+ * block, without a separate allocation per entry, and a separate array of 
+ * control bytes is probed a group at a time with SSE2 or NEON where 
+ * available. 
+ *
+ * When the map grows, and it is the last allocation in the current pool, it is
+ * rehashed in place. Otherwise, it is rehashed into a new block, and the old 
+ * one is left to be reclaimed with the arena. The map is dropped when its 
+ * arena is reset or destroyed. */
+typedef struct arena_map ArenaMap;
+
+/* Returns a new map allocated from `arena`, with keys of `key_size` bytes and
+ * values of `value_size` bytes, with room for at least `capacity` entries
+ * before it has to grow. `value_size` may be 0, for a set.
+ *
+ * Keys and values are aligned to `alignment`, which must be a power of 2, and 
+ * at least the alignment of both the key and the value types.
+ *
+ * Returns `nullptr` if the request can not be entertained, i.e. would 
+ * overflow, or `arena` is full, or if `key_size` or `alignment` is 0, or if 
+ * `alignment` is not a power of 2. */
+ArenaMap *arena_map_new(Arena *arena,
+                        size_t alignment,
+                        size_t key_size,
+                        size_t value_size,
+                        size_t capacity) ATTRIB_NONNULL;
+
+/* Returns a pointer to the value of `key` in `map`, or `nullptr` if `key` is 
+ * not present. */
+void *arena_map_get(const ArenaMap *map, const void *key) 
+    ATTRIB_PURE ATTRIB_NONNULL;
+
+/* Inserts `key` into `map` if it is not present, growing the map if need be.
+ *
+ * If `value` is not `nullptr`, `value_size` bytes are copied from it into the
+ * value of `key`. Else the value of a new key is left uninitialized, and that 
+ * of an existing key is left unchanged.
+ *
+ * Returns a pointer to the value of `key`, or `nullptr` if the map could not 
+ * grow. `arena` must be the arena that `map` was allocated from. Pointers to 
+ * the keys and values of `map` are invalidated if it grows. */
+void *arena_map_put(Arena *arena, 
+                    ArenaMap *map, 
+                    const void *key, 
+                    const void *value) ATTRIB_NONNULLEX(1, 2, 3);
+
+/* Removes `key` from `map`. Returns `false` if `key` was not present, else 
+ * returns `true`. */
+bool arena_map_remove(ArenaMap *map, const void *key) ATTRIB_NONNULL;
+
+/* Iterates over the entries of `map`, in no particular order. 
+ *
+ * `*iter` must be 0 for the first call. If there is an entry left, sets 
+ * `*key` and `*value` to point to its key and value, unless they are 
+ * `nullptr`, and returns `true`. Else returns `false`. The map must not be 
+ * modified during the iteration. */
+bool arena_map_next(const ArenaMap *map, 
+                    size_t *iter, 
+                    void **key, 
+                    void **value) ATTRIB_NONNULLEX(1, 2);
+
+/* Returns the number of entries in `map`. */
+size_t arena_map_count(const ArenaMap *map) ATTRIB_PURE ATTRIB_NONNULL;
+
 #endif                          /* ARENA_H */
@@ -0,0 +1,834 @@
+/* Benchmarks for the arena allocator.
+ *
+ * Every benchmark prints a row of tab-separated values to stdout, preceded by a
+ * header row, so that the output can be fed to a spreadsheet, awk, or diffed
+ * between two builds:
+ *
+ *      name    size    align   ops     ns_per_op   mops_per_sec
+ *
+ * `size` and `align` are 0 where they do not apply. `ns_per_op` is the median
+ * over several runs.
+ *
+ * With --latency, every allocation is timed on its own with the CPU's cycle 
+ * counter instead, and the percentiles of the samples are printed:
+ *
+ *      name    samples unit    p50     p99     p99.9   max
+ *
+ * With --histogram, the samples are printed as a histogram with power-of-2 
+ * buckets, one row per non-empty bucket:
+ *
+ *      name    lo      hi      count
+ *
+ * With --perf, hardware and software counters are read around each benchmark
+ * with perf_event_open(), and their averages per operation are appended to 
+ * every row of the first two tables:
+ *
+ *      cycles  instructions    l1d_misses  llc_misses  dtlb_misses page_faults
+ *
+ * Counters that can not be opened, e.g. outside Linux, in a virtual machine, 
+ * or when /proc/sys/kernel/perf_event_paranoid forbids it, are printed as `-`,
+ * and the timings are still reported. When the PMU has fewer slots than there
+ * are counters, the kernel multiplexes them, and each count is scaled up by 
+ * the fraction of the time it was actually counting.
+ *
+ * Usage: benchmark [--latency | --histogram] [--perf] [filter]
+ *
+ * If `filter` is given, only the benchmarks whose names contain it are run. */
+
+/* For clock_gettime(), and syscall() on Linux. These cause compilation to fail
+ * on MacOS, hence they're guarded. */
+#if defined(__linux__)
+    #define _GNU_SOURCE
+#elif defined(__sun) && defined(__SVR4)
+    #define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "arena.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__linux__)
+    #include <linux/perf_event.h>
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+    #define HAVE_PERF_EVENTS
+#endif
+
+/* *INDENT-OFF* */
+/* In C2X/C23 or later, nullptr is a keyword. */
+/* Patch up C18 (__STDC_VERSION__ == 201710L) and earlier versions.  */
+#if !defined(__STDC_VERSION__) || __STDC_VERSION__ <= 201710L
+    #define nullptr ((void *)0)
+#endif
+
+#if defined(_WIN32)
+    #include <malloc.h>
+    #define aligned_malloc(alignment, size) _aligned_malloc(size, alignment)
+    #define aligned_free(p)                 _aligned_free(p)
+#else
+    #define aligned_malloc(alignment, size) aligned_alloc(alignment, size)
+    #define aligned_free(p)                 free(p)
+#endif
+/* *INDENT-ON* */
+
+#define RUNS            7
+#define MAX_OPS         100000
+#define WORKING_SET     (16 * (size_t) 1024 * 1024)
+#define SAMPLES         200000
+#define HIST_BUCKETS    64
+
+typedef struct {
+    size_t size;
+    size_t alignment;
+} Request;
+
+/* Keeps the compiler from optimizing the allocations away. */
+static volatile uintptr_t sink;
+
+static const char *filter;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+#if defined(CLOCK_MONOTONIC)
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    timespec_get(&ts, TIME_UTC);
+#endif
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+/* Reads the CPU's cycle counter, or falls back to nanoseconds. The fence keeps
+ * the counter from being read before the preceding instructions are done. */
+#if (defined(__GNUC__) || defined(__clang__)) \
+    && (defined(__x86_64__) || defined(__i386__))
+    #define CYCLES_UNIT "cycles"
+
+static inline uint64_t cycles(void)
+{
+    __builtin_ia32_lfence();
+    return __builtin_ia32_rdtsc();
+}
+#elif (defined(__GNUC__) || defined(__clang__)) && defined(__aarch64__)
+    #define CYCLES_UNIT "ticks"
+
+static inline uint64_t cycles(void)
+{
+    uint64_t t;
+
+    __asm__ __volatile__("isb\n\tmrs %0, cntvct_el0" : "=r"(t) :: "memory");
+    return t;
+}
+#else
+    #define CYCLES_UNIT "ns"
+
+static inline uint64_t cycles(void)
+{
+    return now_ns();
+}
+#endif
+
+/* *INDENT-OFF* */
+static const char *const counter_names[] = {
+    "cycles", "instructions", "l1d_misses", "llc_misses", "dtlb_misses", 
+    "page_faults",
+};
+/* *INDENT-ON* */
+
+#define NCOUNTERS (sizeof counter_names / sizeof counter_names[0])
+
+static bool perf_enabled;
+static int counter_fds[NCOUNTERS];
+static uint64_t counter_values[NCOUNTERS];
+
+#ifdef HAVE_PERF_EVENTS
+    #define CACHE_READ_MISS(cache) ((cache) \
+        | (PERF_COUNT_HW_CACHE_OP_READ << 8) \
+        | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+/* Same order as counter_names. */
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} counter_events[NCOUNTERS] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D) },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB) },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+};
+#endif
+
+/* Opens the counters that are available. Each one is opened on its own rather
+ * than as a group, so that one that is missing does not take the others down 
+ * with it. They may then be multiplexed, so each also reports how long it was
+ * enabled and how long it was running. */
+static void counters_open(void)
+{
+    size_t opened = 0;
+
+    for (size_t i = 0; i < NCOUNTERS; ++i) {
+        counter_fds[i] = -1;
+
+#ifdef HAVE_PERF_EVENTS
+        struct perf_event_attr attr;
+
+        memset(&attr, 0, sizeof attr);
+        attr.size = sizeof attr;
+        attr.type = counter_events[i].type;
+        attr.config = counter_events[i].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED 
+            | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        counter_fds[i] = 
+            (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+        opened += counter_fds[i] != -1;
+    }
+
+    if (opened < NCOUNTERS) {
+        fprintf(stderr, "benchmark: %zu of %zu counters are unavailable, and "
+            "are reported as '-'.\n", NCOUNTERS - opened, NCOUNTERS);
+    }
+}
+
+static void counters_start(void)
+{
+#ifdef HAVE_PERF_EVENTS
+    for (size_t i = 0; perf_enabled && i < NCOUNTERS; ++i) {
+        if (counter_fds[i] != -1) {
+            ioctl(counter_fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(counter_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+}
+
+static void counters_stop(void)
+{
+#ifdef HAVE_PERF_EVENTS
+    for (size_t i = 0; perf_enabled && i < NCOUNTERS; ++i) {
+        if (counter_fds[i] != -1) {
+            /* The count, and the times the counter was enabled and running,
+             * as requested by read_format. */
+            uint64_t values[3];
+
+            ioctl(counter_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+            if (read(counter_fds[i], values, sizeof values) != sizeof values
+                || values[2] == 0) {
+                counter_values[i] = 0;
+            } else if (values[2] < values[1]) {
+                /* Extrapolate to the whole time the counter was enabled. */
+                counter_values[i] = (uint64_t) ((double) values[0] 
+                    * (double) values[1] / (double) values[2]);
+            } else {
+                counter_values[i] = values[0];
+            }
+        }
+    }
+#endif
+}
+
+/* Prints the counters read by the last counters_stop(), divided by `ops`, as
+ * extra columns of the current row. */
+static void print_counters(size_t ops)
+{
+    for (size_t i = 0; perf_enabled && i < NCOUNTERS; ++i) {
+        if (counter_fds[i] == -1) {
+            fputs("\t-", stdout);
+        } else {
+            printf("\t%.3f", (double) counter_values[i] / (double) ops);
+        }
+    }
+}
+
+static void print_header(const char *columns)
+{
+    fputs(columns, stdout);
+
+    for (size_t i = 0; perf_enabled && i < NCOUNTERS; ++i) {
+        printf("\t%s", counter_names[i]);
+    }
+
+    putchar('\n');
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    const uint64_t x = *(const uint64_t *) a;
+    const uint64_t y = *(const uint64_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+static bool selected(const char *name)
+{
+    return filter == nullptr || strstr(name, filter) != nullptr;
+}
+
+static void report(const char *name,
+                   size_t size,
+                   size_t alignment,
+                   size_t ops,
+                   uint64_t ns[static RUNS])
+{
+    qsort(ns, RUNS, sizeof ns[0], cmp_u64);
+
+    const double ns_per_op = (double) ns[RUNS / 2] / (double) ops;
+
+    printf("%s\t%zu\t%zu\t%zu\t%.2f\t%.2f", name, size, alignment, ops,
+        ns_per_op, ns_per_op > 0 ? 1e3 / ns_per_op : 0.0);
+    print_counters(ops * RUNS);
+    putchar('\n');
+}
+
+/* Returns the number of allocations of `size` bytes that fit in the working
+ * set. */
+static size_t ops_for(size_t size)
+{
+    const size_t ops = WORKING_SET / size;
+
+    return ops < MAX_OPS ? ops : MAX_OPS;
+}
+
+static Arena *xarena_new(size_t capacity)
+{
+    Arena *const arena = arena_new(nullptr, capacity);
+
+    if (arena == nullptr) {
+        fputs("benchmark: arena_new() failed.\n", stderr);
+        exit(EXIT_FAILURE);
+    }
+
+    return arena;
+}
+
+static void *xcheck(void *p, const char *what)
+{
+    if (p == nullptr) {
+        fprintf(stderr, "benchmark: %s failed.\n", what);
+        exit(EXIT_FAILURE);
+    }
+
+    return p;
+}
+
+/* Allocates `ops` blocks as described by `reqs` from a fresh arena, touching
+ * the first byte of each, and resets the arena. */
+static void run_arena(Arena *arena, const Request *reqs, size_t ops)
+{
+    for (size_t i = 0; i < ops; ++i) {
+        uint8_t *const p = xcheck(arena_alloc(arena, reqs[i].alignment,
+                                              reqs[i].size), "arena_alloc()");
+
+        *p = (uint8_t) i;
+        sink += (uintptr_t) p;
+    }
+
+    arena_reset(arena);
+}
+
+/* Same as run_arena(), but with malloc() and free(). */
+static void run_malloc(void **ptrs, const Request *reqs, size_t ops)
+{
+    for (size_t i = 0; i < ops; ++i) {
+        uint8_t *const p = xcheck(reqs[i].alignment <= sizeof (max_align_t)
+            ? malloc(reqs[i].size)
+            : aligned_malloc(reqs[i].alignment, reqs[i].size), "malloc()");
+
+        *p = (uint8_t) i;
+        sink += (uintptr_t) p;
+        ptrs[i] = p;
+    }
+
+    for (size_t i = 0; i < ops; ++i) {
+        if (reqs[i].alignment <= sizeof (max_align_t)) {
+            free(ptrs[i]);
+        } else {
+            aligned_free(ptrs[i]);
+        }
+    }
+}
+
+/* Times `ops` allocations described by `reqs`, from an arena and from
+ * malloc(). */
+static void bench_alloc_vs_malloc(const char *arena_name,
+                                  const char *malloc_name,
+                                  const Request *reqs,
+                                  size_t ops,
+                                  size_t size,
+                                  size_t alignment)
+{
+    static void *ptrs[MAX_OPS];
+    uint64_t ns[RUNS];
+
+    if (selected(arena_name)) {
+        size_t capacity = 0;
+
+        for (size_t i = 0; i < ops; ++i) {
+            capacity += reqs[i].size + reqs[i].alignment;
+        }
+
+        Arena *const arena = xarena_new(capacity);
+
+        /* Fault the pool in before timing. */
+        run_arena(arena, reqs, ops);
+
+        counters_start();
+
+        for (size_t r = 0; r < RUNS; ++r) {
+            const uint64_t start = now_ns();
+
+            run_arena(arena, reqs, ops);
+            ns[r] = now_ns() - start;
+        }
+
+        counters_stop();
+
+        arena_destroy(arena);
+        report(arena_name, size, alignment, ops, ns);
+    }
+
+    if (selected(malloc_name)) {
+        run_malloc(ptrs, reqs, ops);
+
+        counters_start();
+
+        for (size_t r = 0; r < RUNS; ++r) {
+            const uint64_t start = now_ns();
+
+            run_malloc(ptrs, reqs, ops);
+            ns[r] = now_ns() - start;
+        }
+
+        counters_stop();
+
+        report(malloc_name, size, alignment, ops, ns);
+    }
+}
+
+static void bench_fixed_sizes(void)
+{
+    static const size_t sizes[] = { 8, 16, 64, 256, 1024, 4096 };
+    static const size_t alignments[] = { 1, 8, 16, 64 };
+    static Request reqs[MAX_OPS];
+
+    for (size_t s = 0; s < sizeof sizes / sizeof sizes[0]; ++s) {
+        for (size_t a = 0; a < sizeof alignments / sizeof alignments[0]; ++a) {
+            if (sizes[s] % alignments[a] != 0) {
+                continue;
+            }
+
+            const size_t ops = ops_for(sizes[s]);
+
+            for (size_t i = 0; i < ops; ++i) {
+                reqs[i] = (Request) { sizes[s], alignments[a] };
+            }
+
+            bench_alloc_vs_malloc("arena_alloc", "malloc", reqs, ops,
+                                  sizes[s], alignments[a]);
+        }
+    }
+}
+
+/* A mix of small and medium sizes of assorted alignments, skewed towards the
+ * small end, as seen in typical parsers and request handlers. */
+static void bench_mixed_sizes(void)
+{
+    static const Request mix[] = {
+        { 8, 8 }, { 16, 8 }, { 16, 16 }, { 24, 8 }, { 32, 16 }, { 48, 16 },
+        { 64, 64 }, { 5, 1 }, { 13, 1 }, { 100, 4 }, { 256, 32 }, { 1024, 8 },
+    };
+    static Request reqs[MAX_OPS];
+    uint32_t state = 12345;
+
+    for (size_t i = 0; i < MAX_OPS; ++i) {
+        /* xorshift32: cheap, and the same sequence on every platform. */
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+
+        const size_t n = sizeof mix / sizeof mix[0];
+        const size_t k = (state % n) * (state / n % n) / n;
+
+        reqs[i] = mix[k];
+    }
+
+    bench_alloc_vs_malloc("arena_alloc_mixed", "malloc_mixed", reqs, MAX_OPS,
+                          0, 0);
+}
+
+/* Creates an arena, makes one allocation from it, and destroys it. */
+static void bench_new_destroy(void)
+{
+    static const size_t capacities[] = {
+        4096, 64 * 1024, DEFAULT_BUF_CAP, 1024 * 1024
+    };
+    const size_t ops = 10000;
+    uint64_t ns[RUNS];
+
+    if (!selected("arena_new_destroy")) {
+        return;
+    }
+
+    for (size_t c = 0; c < sizeof capacities / sizeof capacities[0]; ++c) {
+        counters_start();
+
+        for (size_t r = 0; r < RUNS; ++r) {
+            const uint64_t start = now_ns();
+
+            for (size_t i = 0; i < ops; ++i) {
+                Arena *const arena = xarena_new(capacities[c]);
+                uint8_t *const p =
+                    xcheck(arena_alloc(arena, 8, 64), "arena_alloc()");
+
+                *p = (uint8_t) i;
+                sink += (uintptr_t) p;
+                arena_destroy(arena);
+            }
+
+            ns[r] = now_ns() - start;
+        }
+
+        counters_stop();
+
+        report("arena_new_destroy", capacities[c], 0, ops, ns);
+    }
+}
+
+/* Fills the default pool with 64-byte blocks, and resets it, over and over. */
+static void bench_reset_reuse(void)
+{
+    const size_t cycles = 100;
+    const size_t per_cycle = DEFAULT_BUF_CAP / 64;
+    uint64_t ns[RUNS];
+
+    if (!selected("arena_reset_reuse")) {
+        return;
+    }
+
+    Arena *const arena = xarena_new(0);
+
+    counters_start();
+
+    for (size_t r = 0; r < RUNS; ++r) {
+        const uint64_t start = now_ns();
+
+        for (size_t c = 0; c < cycles; ++c) {
+            for (size_t i = 0; i < per_cycle; ++i) {
+                uint8_t *const p =
+                    xcheck(arena_alloc(arena, 8, 64), "arena_alloc()");
+
+                *p = (uint8_t) i;
+                sink += (uintptr_t) p;
+            }
+
+            arena_reset(arena);
+        }
+
+        ns[r] = now_ns() - start;
+    }
+
+    counters_stop();
+
+    arena_destroy(arena);
+    report("arena_reset_reuse", 64, 8, cycles * per_cycle, ns);
+}
+
+static void bench_allocarray(void)
+{
+    static const size_t nmembs[] = { 4, 32, 256 };
+    uint64_t ns[RUNS];
+
+    if (!selected("arena_allocarray")) {
+        return;
+    }
+
+    for (size_t n = 0; n < sizeof nmembs / sizeof nmembs[0]; ++n) {
+        const size_t size = nmembs[n] * sizeof (double);
+        const size_t ops = ops_for(size);
+        Arena *const arena = xarena_new(ops * size);
+
+        counters_start();
+
+        for (size_t r = 0; r < RUNS; ++r) {
+            const uint64_t start = now_ns();
+
+            for (size_t i = 0; i < ops; ++i) {
+                double *const p = xcheck(arena_allocarray(arena,
+                    sizeof (double), nmembs[n], sizeof *p),
+                    "arena_allocarray()");
+
+                *p = (double) i;
+                sink += (uintptr_t) p;
+            }
+
+            ns[r] = now_ns() - start;
+            arena_reset(arena);
+        }
+
+        counters_stop();
+
+        arena_destroy(arena);
+        report("arena_allocarray", size, sizeof (double), ops, ns);
+    }
+}
+
+/* Grows a block in place 16 bytes at a time, with arena_realloc(), and an
+ * array one element at a time, with arena_vec_push(). */
+static void bench_realloc_growth(void)
+{
+    const size_t ops = MAX_OPS;
+    uint64_t ns[RUNS];
+    Arena *const arena = xarena_new(ops * 16 + 4096);
+
+    if (selected("arena_realloc")) {
+        counters_start();
+
+        for (size_t r = 0; r < RUNS; ++r) {
+            const uint64_t start = now_ns();
+            uint8_t *const p = xcheck(arena_alloc(arena, 16, 16),
+                                      "arena_alloc()");
+
+            for (size_t i = 1; i < ops; ++i) {
+                if (!arena_realloc(arena, (i + 1) * 16)) {
+                    xcheck(nullptr, "arena_realloc()");
+                }
+                p[i * 16] = (uint8_t) i;
+            }
+
+            ns[r] = now_ns() - start;
+            sink += (uintptr_t) p;
+            arena_reset(arena);
+        }
+
+        counters_stop();
+
+        report("arena_realloc", 16, 16, ops - 1, ns);
+    }
+
+    if (selected("arena_vec_push")) {
+        counters_start();
+
+        for (size_t r = 0; r < RUNS; ++r) {
+            const uint64_t start = now_ns();
+            ArenaVec vec;
+
+            arena_vec_init(&vec, 8, 8);
+
+            for (uint64_t i = 0; i < ops; ++i) {
+                xcheck(arena_vec_push(arena, &vec, &i), "arena_vec_push()");
+            }
+
+            ns[r] = now_ns() - start;
+            sink += (uintptr_t) vec.data;
+            arena_reset(arena);
+        }
+
+        counters_stop();
+
+        report("arena_vec_push", 8, 8, ops, ns);
+    }
+
+    arena_destroy(arena);
+}
+
+typedef enum {
+    MODE_THROUGHPUT,
+    MODE_LATENCY,
+    MODE_HISTOGRAM,
+} Mode;
+
+static Mode mode;
+
+static uint64_t samples[SAMPLES];
+
+/* Returns the value below which `permille`/1000 of the sorted samples fall. */
+static uint64_t percentile(size_t n, unsigned permille)
+{
+    const size_t i = (size_t) ((double) n * permille / 1000.0);
+
+    return samples[i < n ? i : n - 1];
+}
+
+static void report_latency(const char *name, size_t n)
+{
+    if (mode == MODE_HISTOGRAM) {
+        size_t buckets[HIST_BUCKETS] = { 0 };
+
+        for (size_t i = 0; i < n; ++i) {
+            size_t b = 0;
+
+            while (b < HIST_BUCKETS - 1 && samples[i] >> (b + 1) != 0) {
+                ++b;
+            }
+
+            ++buckets[b];
+        }
+
+        for (size_t b = 0; b < HIST_BUCKETS; ++b) {
+            if (buckets[b] != 0) {
+                printf("%s\t%llu\t%llu\t%zu\n", name,
+                    b == 0 ? 0ull : 1ull << b, (2ull << b) - 1, buckets[b]);
+            }
+        }
+
+        return;
+    }
+
+    qsort(samples, n, sizeof samples[0], cmp_u64);
+    printf("%s\t%zu\t%s\t%llu\t%llu\t%llu\t%llu", name, n, CYCLES_UNIT,
+        (unsigned long long) percentile(n, 500),
+        (unsigned long long) percentile(n, 990),
+        (unsigned long long) percentile(n, 999),
+        (unsigned long long) samples[n - 1]);
+    print_counters(n);
+    putchar('\n');
+}
+
+/* Times allocations of `size` bytes from `arena`, one at a time. When the 
+ * current pool runs out, the timed call includes adding a new pool with 
+ * arena_resize(), as an application would have to. */
+static Arena *sample_allocs(Arena *arena, size_t size, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        const uint64_t start = cycles();
+        uint8_t *p = arena_alloc(arena, 8, size);
+
+        if (p == nullptr) {
+            arena = xcheck(arena_resize(arena, nullptr, 0), "arena_resize()");
+            p = arena_alloc(arena, 8, size);
+        }
+
+        const uint64_t end = cycles();
+
+        *(uint8_t *) xcheck(p, "arena_alloc()") = (uint8_t) i;
+        sink += (uintptr_t) p;
+        samples[i] = end - start;
+    }
+
+    return arena;
+}
+
+/* Allocations that always fit in the current pool. */
+static void latency_steady(void)
+{
+    if (!selected("latency_steady")) {
+        return;
+    }
+
+    Arena *arena = xarena_new(SAMPLES * 64);
+
+    arena = sample_allocs(arena, 64, SAMPLES);
+    arena_reset(arena);
+    counters_start();
+    arena = sample_allocs(arena, 64, SAMPLES);
+    counters_stop();
+    arena_destroy(arena);
+    report_latency("latency_steady", SAMPLES);
+}
+
+/* 1 KiB allocations from default-sized pools, so that one call in 256 has to 
+ * add a new pool. */
+static void latency_pool_boundary(void)
+{
+    if (!selected("latency_pool_boundary")) {
+        return;
+    }
+
+    Arena *arena = xarena_new(0);
+
+    counters_start();
+    arena = sample_allocs(arena, 1024, SAMPLES);
+    counters_stop();
+    arena_destroy(arena);
+    report_latency("latency_pool_boundary", SAMPLES);
+}
+
+/* The same allocations as latency_pool_boundary, after a reset, so that the 
+ * pools that have already been added are reused. */
+static void latency_post_reset(void)
+{
+    if (!selected("latency_post_reset")) {
+        return;
+    }
+
+    Arena *arena = xarena_new(0);
+
+    arena = sample_allocs(arena, 1024, SAMPLES);
+    arena_reset(arena);
+    counters_start();
+    arena = sample_allocs(arena, 1024, SAMPLES);
+    counters_stop();
+    arena_destroy(arena);
+    report_latency("latency_post_reset", SAMPLES);
+}
+
+int main(int argc, char *argv[])
+{
+    int arg = 1;
+
+    for (; arg < argc && argv[arg][0] == '-'; ++arg) {
+        if (strcmp(argv[arg], "--latency") == 0) {
+            mode = MODE_LATENCY;
+        } else if (strcmp(argv[arg], "--histogram") == 0) {
+            mode = MODE_HISTOGRAM;
+        } else if (strcmp(argv[arg], "--perf") == 0) {
+            perf_enabled = true;
+        } else {
+            break;
+        }
+    }
+
+    if (argc - arg > 1 || (arg < argc && argv[arg][0] == '-')) {
+        fprintf(stderr, 
+            "Usage: %s [--latency | --histogram] [--perf] [filter]\n", 
+            argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    filter = arg < argc ? argv[arg] : nullptr;
+
+    /* The histogram has no room for the counters. */
+    perf_enabled = perf_enabled && mode != MODE_HISTOGRAM;
+
+    if (perf_enabled) {
+        counters_open();
+    }
+
+    switch (mode) {
+        case MODE_THROUGHPUT:
+            print_header("name\tsize\talign\tops\tns_per_op\tmops_per_sec");
+            bench_fixed_sizes();
+            bench_mixed_sizes();
+            bench_new_destroy();
+            bench_reset_reuse();
+            bench_allocarray();
+            bench_realloc_growth();
+            break;
+        case MODE_LATENCY:
+            print_header("name\tsamples\tunit\tp50\tp99\tp99.9\tmax");
+            latency_steady();
+            latency_pool_boundary();
+            latency_post_reset();
+            break;
+        case MODE_HISTOGRAM:
+            print_header("name\tlo\thi\tcount");
+            latency_steady();
+            latency_pool_boundary();
+            latency_post_reset();
+            break;
+    }
+
+    return EXIT_SUCCESS;
+}
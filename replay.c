@@ -0,0 +1,351 @@
+/* Replays an allocation trace, recorded by a build of the library with
+ * `ARENA_TRACE` defined, against the current build, and reports how long it
+ * took and how much memory it used, as a row of tab-separated values preceded
+ * by a header row, like the benchmarks:
+ *
+ *      events  skipped failed  diverged    ns_per_event    peak_reserved   peak_used
+ *
+ * `skipped` counts the events on arenas created before the trace started,
+ * which can not be replayed. `failed` counts the calls that failed in the
+ * replay, and `diverged` those that succeeded in the recording and failed in
+ * the replay, or the other way around. `ns_per_event` is the median over
+ * several runs. `peak_reserved` is the highest number of bytes held by all
+ * the live arenas, metadata included, and `peak_used` the highest number of
+ * bytes handed out by them.
+ *
+ * Arenas that were given a buffer in the recording get one from the library
+ * instead.
+ *
+ * Usage: replay [--runs N] trace */
+
+/* For clock_gettime(). These cause compilation to fail on MacOS, hence they're
+ * guarded. */
+#if defined(__linux__)
+    #define _GNU_SOURCE
+#elif defined(__sun) && defined(__SVR4)
+    #define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "arena.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* *INDENT-OFF* */
+/* In C2X/C23 or later, nullptr is a keyword. */
+/* Patch up C18 (__STDC_VERSION__ == 201710L) and earlier versions.  */
+#if !defined(__STDC_VERSION__) || __STDC_VERSION__ <= 201710L
+    #define nullptr ((void *)0)
+#endif
+/* *INDENT-ON* */
+
+#define DEFAULT_RUNS    5
+#define MAX_RUNS        101
+
+typedef struct {
+    ArenaTraceEvent *events;
+    size_t count;
+    size_t arenas;              /* The ids of the events run from 1 to this. */
+} Trace;
+
+typedef struct {
+    size_t skipped;
+    size_t failed;
+    size_t diverged;
+    size_t peak_reserved;
+    size_t peak_used;
+} Result;
+
+/* Passed as the buffer of arenas that were given one, with a capacity of 0,
+ * so that the call fails as it did in the recording. */
+static char dummy;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+#if defined(CLOCK_MONOTONIC)
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    timespec_get(&ts, TIME_UTC);
+#endif
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    const uint64_t x = *(const uint64_t *) a;
+    const uint64_t y = *(const uint64_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+/* Renumbers the arenas of `trace` from 1 in the order of their ids, which 
+ * count every arena created by the recording process, and may be read from a
+ * corrupt trace, so that they can index an array of the arenas. */
+static bool trace_remap(Trace *trace)
+{
+    uint64_t *const ids = malloc((trace->count != 0 ? trace->count : 1) 
+                                 * sizeof *ids);
+    size_t n = 0;
+
+    if (ids == nullptr) {
+        fprintf(stderr, "replay: out of memory.\n");
+        return false;
+    }
+
+    for (size_t i = 0; i < trace->count; ++i) {
+        if (trace->events[i].arena != 0) {
+            ids[n++] = trace->events[i].arena;
+        }
+    }
+
+    qsort(ids, n, sizeof ids[0], cmp_u64);
+    trace->arenas = 0;
+
+    for (size_t i = 0; i < n; ++i) {
+        if (trace->arenas == 0 || ids[i] != ids[trace->arenas - 1]) {
+            ids[trace->arenas++] = ids[i];
+        }
+    }
+
+    for (size_t i = 0; i < trace->count; ++i) {
+        ArenaTraceEvent *const e = &trace->events[i];
+
+        if (e->arena != 0) {
+            const uint64_t *const id = 
+                bsearch(&e->arena, ids, trace->arenas, sizeof ids[0], cmp_u64);
+
+            e->arena = (uint64_t) (id - ids) + 1;
+        }
+    }
+
+    free(ids);
+    return true;
+}
+
+/* Reads the whole trace at `path` into memory, so that reading it is not
+ * timed. A truncated trace, e.g. from a process that crashed, is replayed up
+ * to where it ends. */
+static bool trace_load(const char *path, Trace *trace)
+{
+    FILE *const stream = fopen(path, "rb");
+    size_t cap = 0;
+
+    if (stream == nullptr) {
+        perror(path);
+        return false;
+    }
+
+    if (!arena_trace_read_header(stream)) {
+        fprintf(stderr, "replay: %s is not a trace.\n", path);
+        fclose(stream);
+        return false;
+    }
+
+    for (;;) {
+        ArenaTraceEvent event;
+        const int rc = arena_trace_read(stream, &event);
+
+        if (rc == 0) {
+            break;
+        }
+
+        if (rc < 0) {
+            fprintf(stderr, "replay: %s is malformed or truncated after %zu "
+                "events.\n", path, trace->count);
+            break;
+        }
+
+        if (trace->count == cap) {
+            cap = cap != 0 ? cap * 2 : 1024;
+            ArenaTraceEvent *const tmp =
+                realloc(trace->events, cap * sizeof *tmp);
+
+            if (tmp == nullptr) {
+                fprintf(stderr, "replay: out of memory.\n");
+                fclose(stream);
+                return false;
+            }
+
+            trace->events = tmp;
+        }
+
+        trace->events[trace->count++] = event;
+    }
+
+    fclose(stream);
+    return trace_remap(trace);
+}
+
+/* Executes the events of `trace`, using `arenas` to map the ids of the trace to
+ * the live arenas. The memory is only measured if `result` is not `nullptr`,
+ * so that measuring it is not timed. */
+static void replay(const Trace *trace, Arena **arenas, Result *result)
+{
+    size_t reserved = 0;
+    size_t used = 0;
+
+    memset(arenas, 0, (trace->arenas + 1) * sizeof *arenas);
+
+    for (size_t i = 0; i < trace->count; ++i) {
+        const ArenaTraceEvent *const e = &trace->events[i];
+        const size_t *const args = e->args;
+        void *const buf = args[1] != 0 && args[0] == 0 ? &dummy : nullptr;
+        Arena *arena = arenas[e->arena];
+        bool ok = true;
+
+        if (arena == nullptr && e->op != ARENA_TRACE_NEW) {
+            if (result != nullptr) {
+                ++result->skipped;
+            }
+            continue;
+        }
+
+        if (result != nullptr && arena != nullptr) {
+            reserved -= arena_allocated_bytes_including_metadata(arena);
+            used -= arena_used_bytes(arena);
+        }
+
+        switch (e->op) {
+            case ARENA_TRACE_NEW:
+                arena = arena_new(buf, args[0]);
+                ok = arena != nullptr;
+
+                /* Failed in the recording, and has no id to be found by. */
+                if (arena != nullptr && e->arena == 0) {
+                    arena_destroy(arena);
+                    arena = nullptr;
+                }
+                break;
+            case ARENA_TRACE_ALLOC:
+                ok = arena_alloc(arena, args[0], args[1]) != nullptr;
+                break;
+            case ARENA_TRACE_ALLOCARRAY:
+                ok = arena_allocarray(arena, args[0], args[1], args[2])
+                    != nullptr;
+                break;
+            case ARENA_TRACE_REALLOC:
+                ok = arena_realloc(arena, args[0]);
+                break;
+            case ARENA_TRACE_RESIZE: {
+                Arena *const resized = arena_resize(arena, buf, args[0]);
+
+                ok = resized != nullptr;
+                arena = ok ? resized : arena;
+                break;
+            }
+            case ARENA_TRACE_RESET:
+                arena_reset(arena);
+                break;
+            case ARENA_TRACE_DESTROY:
+                arena_destroy(arena);
+                arena = nullptr;
+                break;
+            case ARENA_TRACE_ALLOC_TOP:
+                ok = arena_alloc_top(arena, args[0], args[1]) != nullptr;
+                break;
+            case ARENA_TRACE_RESET_TOP:
+                arena_reset_top(arena);
+                break;
+            case ARENA_TRACE_SET_LARGE_THRESHOLD:
+                arena_set_large_threshold(arena, args[0]);
+                break;
+            case ARENA_TRACE_RESET_CONSOLIDATE:
+                ok = arena_reset_consolidate(arena, 
+                    (double) args[0] / ARENA_TRACE_SLACK_SCALE);
+                break;
+        }
+
+        if (e->arena != 0) {
+            arenas[e->arena] = arena;
+        }
+
+        if (result == nullptr) {
+            continue;
+        }
+
+        result->failed += !ok;
+        result->diverged += ok != e->ok;
+
+        if (arena != nullptr) {
+            reserved += arena_allocated_bytes_including_metadata(arena);
+            used += arena_used_bytes(arena);
+        }
+
+        if (reserved > result->peak_reserved) {
+            result->peak_reserved = reserved;
+        }
+
+        if (used > result->peak_used) {
+            result->peak_used = used;
+        }
+    }
+
+    /* The arenas the trace did not destroy. */
+    for (size_t id = 1; id <= trace->arenas; ++id) {
+        if (arenas[id] != nullptr) {
+            arena_destroy(arenas[id]);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    size_t runs = DEFAULT_RUNS;
+    int arg = 1;
+
+    if (arg + 1 < argc && strcmp(argv[arg], "--runs") == 0) {
+        runs = strtoul(argv[arg + 1], nullptr, 10);
+        arg += 2;
+    }
+
+    if (argc - arg != 1 || runs == 0 || runs > MAX_RUNS) {
+        fprintf(stderr, "Usage: %s [--runs N] trace\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    Trace trace = { 0 };
+
+    if (!trace_load(argv[arg], &trace)) {
+        free(trace.events);
+        return EXIT_FAILURE;
+    }
+
+    /* No more arenas than events, so the size does not overflow. */
+    Arena **const arenas = malloc((trace.arenas + 1) * sizeof *arenas);
+
+    if (arenas == nullptr) {
+        fprintf(stderr, "replay: out of memory.\n");
+        free(trace.events);
+        return EXIT_FAILURE;
+    }
+
+    Result result = { 0 };
+    uint64_t ns[MAX_RUNS];
+
+    replay(&trace, arenas, &result);
+
+    for (size_t r = 0; r < runs; ++r) {
+        const uint64_t start = now_ns();
+
+        replay(&trace, arenas, nullptr);
+        ns[r] = now_ns() - start;
+    }
+
+    qsort(ns, runs, sizeof ns[0], cmp_u64);
+
+    printf("events\tskipped\tfailed\tdiverged\tns_per_event\tpeak_reserved\t"
+        "peak_used\n");
+    printf("%zu\t%zu\t%zu\t%zu\t%.2f\t%zu\t%zu\n", trace.count, result.skipped,
+        result.failed, result.diverged,
+        trace.count != 0 ? (double) ns[runs / 2] / (double) trace.count : 0.0,
+        result.peak_reserved, result.peak_used);
+
+    free(arenas);
+    free(trace.events);
+    return EXIT_SUCCESS;
+}
@@ -1,6 +1,11 @@
 /* NOTE: Use TEST_ASSERT() for unrelated functions. Say malloc() calls, or 
  *       calls to arena_new() when testing arena_alloc(). Else use TEST_CHECK().
  */
+/* For MAP_ANONYMOUS in arena.c, which glibc hides in strict ISO C modes. */
+#if defined(ARENA_GUARD) && defined(__linux__)
+    #define _DEFAULT_SOURCE
+#endif
+
 #if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
     #define HAVE_STDALIGN_H
     #include <stdalign.h>
@@ -9,6 +14,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 /* The testing library doesn't define these. Define them here instead of modif-
  * -ying the header. These are needed to compile cleanly with -std=c.. flag.
@@ -24,6 +30,12 @@
 
 #include "arena.c"
 
+#if defined(ARENA_GUARD) && defined(__unix__)
+    #include <fcntl.h>
+    #include <sys/wait.h>
+    #include <unistd.h>
+#endif
+
 /* *INDENT-OFF* */
 /* In C2X/C23 or later, nullptr is a keyword. */
 /* Patch up C18 (__STDC_VERSION__ == 201710L) and earlier versions.  */
@@ -37,6 +49,61 @@ static inline bool is_aligned(const void *ptr, size_t byte_count)
     return (uintptr_t) ptr % byte_count == 0;
 }
 
+/* Reads a byte that debug builds may have poisoned. */
+#if defined(__SANITIZE_ADDRESS__)
+    __attribute__((no_sanitize_address))
+#elif defined(__has_feature)
+    #if __has_feature(address_sanitizer)
+        __attribute__((no_sanitize_address))
+    #endif
+#endif
+static uint8_t peek(const uint8_t *p)
+{
+    return *(const volatile uint8_t *) p;
+}
+
+/* Returns true if the `n` bytes at `p` are all set to 0xA5. */
+static bool is_filled(const uint8_t *p, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        if (peek(p + i) != 0xA5) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* An upstream allocator that counts the bytes it hands out, fills them with 
+ * garbage, and fails once `budget` allocations have been made. */
+typedef struct counting {
+    size_t live;
+    size_t allocs;
+    size_t budget;
+} Counting;
+
+static void *counting_alloc(void *ctx, size_t size)
+{
+    Counting *const c = ctx;
+    void *const p = c->allocs < c->budget ? malloc(size) : nullptr;
+
+    if (p != nullptr) {
+        memset(p, 0xCC, size);
+        c->live += size;
+        ++c->allocs;
+    }
+
+    return p;
+}
+
+static void counting_free(void *ctx, void *ptr, size_t size)
+{
+    Counting *const c = ctx;
+
+    c->live -= size;
+    free(ptr);
+}
+
 static void test_arena_new(void)
 {
     TEST_CHECK(arena_new(stderr, 0) == nullptr);
@@ -110,8 +177,8 @@ static void test_arena_alloc(void)
     uint8_t *const curr_pool = arena->pools[0]->buf;
 
     /* Verify that the remaining bytes have been set to 0xA5. */
-    TEST_CHECK(curr_pool[96] == 0xA5 && curr_pool[97] == 0xA5
-        && curr_pool[98] == 0xA5 && curr_pool[99] == 0xA5);
+    TEST_CHECK(peek(curr_pool + 96) == 0xA5 && peek(curr_pool + 97) == 0xA5
+        && peek(curr_pool + 98) == 0xA5 && peek(curr_pool + 99) == 0xA5);
 
     arena_reset(arena);
 
@@ -147,9 +214,232 @@ static void test_arena_resize(void)
 
     arena_reset(arena);
     TEST_CHECK(arena->current == 1 && arena->count == 2);
+
+    /* Pools emptied by arena_reset() are moved on to before failing. */
+    TEST_CHECK(arena_alloc(arena, 1, 10000));
+    TEST_CHECK(arena->current == 2 && arena->count == 2);
+
+    /* The pool moved on from is still allocated from. */
+    TEST_CHECK(arena_alloc(arena, 1, 1000));
+    TEST_CHECK(arena_alloc(arena, 1, 1) == nullptr);
     arena_destroy(arena);
 }
 
+static void test_arena_reset_consolidate(void)
+{
+    Arena *arena = arena_new(nullptr, 1000);
+
+    TEST_ASSERT(arena);
+    TEST_ASSERT(arena_alloc(arena, 1, 900));
+    arena = arena_resize(arena, nullptr, 2000);
+    TEST_ASSERT(arena);
+    TEST_ASSERT(arena_alloc(arena, 1, 1900));
+    arena = arena_resize(arena, nullptr, 4000);
+    TEST_ASSERT(arena);
+    TEST_ASSERT(arena_alloc(arena, 1, 3000));
+
+    TEST_CHECK(arena_reset_consolidate(arena, 1.5));
+    TEST_CHECK(arena_pool_count(arena) == 1);
+    TEST_CHECK(arena_allocated_bytes(arena) == 8704);
+    TEST_CHECK(arena_used_bytes(arena) == 0);
+    TEST_CHECK(arena_pool_capacity(arena) == 8704);
+
+    /* The next cycle fits in the one pool. */
+    TEST_ASSERT(arena_alloc(arena, 1, 900));
+    TEST_ASSERT(arena_alloc(arena, 1, 1900));
+    TEST_ASSERT(arena_alloc(arena, 1, 3000));
+    TEST_CHECK(arena_reset_consolidate(arena, 1.5));
+    TEST_CHECK(arena_allocated_bytes(arena) == 8704);
+
+    arena = arena_resize(arena, nullptr, 100);
+    TEST_ASSERT(arena);
+    TEST_CHECK(arena_reset_consolidate(arena, 0.0));
+    TEST_CHECK(arena_pool_count(arena) == 1);
+    TEST_CHECK(arena_allocated_bytes(arena) == 8804);
+    arena_destroy(arena);
+
+    /* A buffer supplied by the caller can not be freed. */
+    static uint8_t buf[1000];
+
+    arena = arena_new(buf, sizeof buf);
+    TEST_ASSERT(arena);
+    arena = arena_resize(arena, nullptr, 1000);
+    TEST_ASSERT(arena);
+    TEST_CHECK(!arena_reset_consolidate(arena, 2.0));
+    TEST_CHECK(arena_pool_count(arena) == 2);
+    TEST_CHECK(arena->current == 1 && arena_used_bytes(arena) == 0);
+    arena_destroy(arena);
+}
+
+static void test_arena_new_with(void)
+{
+    Counting c = { .budget = SIZE_MAX };
+    ArenaAllocator upstream = { .alloc = counting_alloc, .ctx = &c };
+
+    TEST_CHECK(arena_new_with(&upstream, nullptr, 100) == nullptr);
+    upstream.free = counting_free;
+
+    Arena *arena = arena_new_with(&upstream, nullptr, 1000);
+
+    TEST_ASSERT(arena);
+    TEST_CHECK(c.live >= 1000 && c.allocs == 3);
+
+    /* Nothing relies on the memory being zeroed. */
+    ArenaMap *const map = 
+        arena_map_new(arena, sizeof (uint64_t), sizeof (uint64_t), 
+                      sizeof (uint64_t), 0);
+
+    TEST_ASSERT(map);
+
+    for (uint64_t k = 0; k < 20; ++k) {
+        TEST_ASSERT(arena_map_put(arena, map, &k, &k));
+    }
+
+    for (uint64_t k = 0; k < 20; ++k) {
+        const uint64_t *const v = arena_map_get(map, &k);
+
+        TEST_CHECK(v && *v == k);
+    }
+
+    TEST_CHECK(arena_map_get(map, &(uint64_t) { 20 }) == nullptr);
+
+    /* The pools, the arena as it grows, and large blocks. */
+    arena = arena_resize(arena, nullptr, 2000);
+    TEST_ASSERT(arena);
+    arena = arena_resize(arena, nullptr, 3000);
+    TEST_ASSERT(arena);
+    TEST_CHECK(arena->capacity == 4);
+    arena_set_large_threshold(arena, ARENA_LARGE_THRESHOLD);
+    TEST_ASSERT(arena_alloc(arena, 1, 1 << 20));
+    TEST_CHECK(c.live > (1 << 20) + 6000);
+
+    /* If the arena can not grow, the new pool is given back, and the arena 
+     * is left as it was. */
+    Arena *const old = arena_resize(arena, nullptr, 100);
+
+    TEST_ASSERT(old);
+    arena = old;
+
+    const size_t live = c.live;
+
+    c.budget = c.allocs + 2;
+    TEST_CHECK(arena_resize(arena, nullptr, 100) == nullptr);
+    TEST_CHECK(c.live == live && arena->capacity == 4 && arena->count == 4);
+    c.budget = c.allocs + 1;
+    TEST_CHECK(arena_resize(arena, nullptr, 100) == nullptr);
+    TEST_CHECK(c.live == live && arena->count == 4);
+    TEST_ASSERT(arena_alloc(arena, 1, 50));
+
+    /* A large block that can not be allocated is counted as a failure. */
+    TEST_CHECK(arena_alloc(arena, 1, 1 << 20) == nullptr);
+    TEST_CHECK(c.live == live);
+
+#ifdef ARENA_STATS
+    ArenaStats stats;
+
+    TEST_ASSERT(arena_stats(arena, &stats));
+    TEST_CHECK(stats.failures == 1);
+#endif
+
+    c.budget = SIZE_MAX;
+    arena = arena_resize(arena, nullptr, 100);
+    TEST_ASSERT(arena);
+    TEST_CHECK(arena->capacity == 8 && arena->count == 5);
+
+    TEST_CHECK(arena_reset_consolidate(arena, 0.0));
+    arena_destroy(arena);
+    TEST_CHECK(c.live == 0);
+}
+
+static void test_arena_new_child(void)
+{
+    Arena *parent = arena_new(nullptr, 100000);
+
+    TEST_ASSERT(parent);
+
+    Arena *child = arena_new_child(parent, 1000);
+
+    TEST_ASSERT(child);
+    TEST_CHECK(owns(parent, child) && owns(parent, child->pools[0]->buf));
+    TEST_CHECK(arena_used_bytes(parent) > 1000);
+
+    /* Resetting the child does not touch the parent. */
+    const size_t used = arena_used_bytes(parent);
+
+    TEST_ASSERT(arena_alloc(child, 1, 1000));
+    arena_reset(child);
+    TEST_CHECK(arena_used_bytes(parent) == used);
+
+    Arena *const grandchild = arena_new_child(child, 100);
+
+    TEST_ASSERT(grandchild);
+    TEST_CHECK(owns(child, grandchild) && owns(child, grandchild->pools[0]->buf));
+
+    /* The links follow the arenas as arena_resize() moves them. */
+    for (int i = 0; i < 2; ++i) {
+        child = arena_resize(child, nullptr, 500);
+        TEST_ASSERT(child);
+        parent = arena_resize(parent, nullptr, 1000);
+        TEST_ASSERT(parent);
+    }
+
+    TEST_CHECK(child->capacity == 4 && parent->capacity == 4);
+    TEST_CHECK(parent->first_child == child && child->parent == parent);
+    TEST_CHECK(child->allocator.ctx == parent);
+    TEST_CHECK(grandchild->parent == child && child->first_child == grandchild);
+    TEST_CHECK(grandchild->allocator.ctx == child);
+
+    /* A child that the parent can not hold comes from upstream. */
+    arena_set_large_threshold(parent, SIZE_MAX);
+
+    Arena *const big = arena_new_child(parent, 200000);
+
+    TEST_ASSERT(big);
+    TEST_CHECK(owns(parent, big) && !owns(parent, big->pools[0]->buf));
+    TEST_CHECK(parent->first_child == big && big->next_sibling == child);
+
+    arena_destroy(child);
+    TEST_CHECK(parent->first_child == big && big->next_sibling == nullptr);
+
+    /* Resetting the parent destroys the children left. */
+    arena_reset(parent);
+    TEST_CHECK(parent->first_child == nullptr);
+
+    TEST_ASSERT(arena_new_child(parent, 0));
+    arena_destroy(parent);
+
+    /* The parent's last allocation is not the child. As the child went right
+     * after it, there is none to resize. */
+    parent = arena_new(nullptr, 100000);
+    TEST_ASSERT(parent);
+
+    uint8_t *const p = arena_alloc(parent, 1, 100);
+
+    TEST_ASSERT(p);
+    child = arena_new_child(parent, 1000);
+    TEST_ASSERT(child);
+
+    const size_t offset = parent->pools[0]->offset;
+
+    TEST_CHECK(arena_realloc(parent, 0));
+    TEST_CHECK(parent->pools[0]->offset == offset);
+
+    uint8_t *const q = arena_alloc(parent, 1, 100);
+
+    TEST_ASSERT(q);
+    TEST_CHECK(!owns(child, q) && q >= child->pools[0]->buf + 1000);
+    arena_destroy(parent);
+
+    /* A child from upstream leaves the last allocation resizable. */
+    parent = arena_new(nullptr, 1000);
+    TEST_ASSERT(parent);
+    TEST_ASSERT(arena_alloc(parent, 1, 990));
+    TEST_ASSERT(arena_new_child(parent, 2000));
+    TEST_CHECK(arena_realloc(parent, 995));
+    TEST_CHECK(arena_pool_capacity(parent) == 5);
+    arena_destroy(parent);
+}
+
 static void test_arena_allocarray(void)
 {
     Arena *const arena = arena_new(nullptr, 100);
@@ -190,6 +480,20 @@ static void test_arena_realloc(void)
     /* Test deletion. */
     TEST_CHECK(arena_realloc(arena, 0));
     TEST_CHECK(arena->pools[0]->offset == 0 && arena->last_alloc_size == 0);
+
+    /* The padding for alignment is not part of the last allocation. */
+    TEST_ASSERT(arena_alloc(arena, 1, 1));
+    const uint8_t *const p = arena_alloc(arena, 8, 8);
+
+    TEST_ASSERT(p);
+    TEST_CHECK(arena->last_alloc_size == 8);
+    TEST_CHECK(arena_realloc(arena, 16));
+    TEST_CHECK(arena->pools[0]->buf + arena->pools[0]->offset == p + 16);
+
+    /* Expansion only needs room for the difference. */
+    TEST_CHECK(arena_realloc(arena, 16 + arena_pool_capacity(arena)));
+    TEST_CHECK(arena_pool_capacity(arena) == 0);
+    TEST_CHECK(!arena_realloc(arena, 17 + arena->last_alloc_size));
     arena_destroy(arena);
 }
 
@@ -232,6 +536,1032 @@ static void test_arena_allocated_bytes_including_metadata(void)
     arena_destroy(arena);
 }
 
+static void test_arena_debug(void)
+{
+#ifdef DEBUG
+    uint8_t buf[64];
+    Arena *const arena = arena_new(buf, sizeof buf);
+
+    TEST_ASSERT(arena);
+    TEST_CHECK(is_filled(buf, sizeof buf));
+
+    /* The padding and the bytes past the block stay set. */
+    uint8_t *const a = arena_alloc(arena, 1, 3);
+    uint8_t *const b = arena_alloc(arena, 8, 8);
+
+    TEST_ASSERT(a && b);
+    memset(a, 0, 3);
+    memset(b, 0, 8);
+    TEST_CHECK(is_filled(a + 3, (size_t) (b - a) - 3));
+    TEST_CHECK(is_filled(b + 8, (size_t) (buf + sizeof buf - b) - 8));
+
+    /* Bytes given back by arena_realloc() are set again. */
+    TEST_CHECK(arena_realloc(arena, 2));
+    TEST_CHECK(is_filled(b + 2, 6) && b[1] == 0);
+    TEST_CHECK(arena_realloc(arena, 16));
+    memset(b, 0, 16);
+    TEST_CHECK(arena_realloc(arena, 0));
+    TEST_CHECK(is_filled(b, 16));
+
+    /* Formatting in place leaves the rest of the pool set. */
+    ArenaStr str = { 0 };
+
+    TEST_CHECK(arena_str_appendf(arena, &str, "%d", 12345));
+    TEST_CHECK(arena_str_appendf(arena, &str, "%s", "6789"));
+    TEST_CHECK(strcmp(str.data, "123456789") == 0);
+    TEST_CHECK(is_filled((uint8_t *) str.data + 10, 
+        (size_t) (buf + sizeof buf - (uint8_t *) str.data) - 10));
+
+    arena_reset(arena);
+    TEST_CHECK(is_filled(buf, sizeof buf));
+    arena_destroy(arena);
+#endif
+}
+
+#if defined(ARENA_GUARD) && defined(__unix__)
+/* Returns true if writing to `p` in a child process kills it, or makes it 
+ * exit with an error, as sanitizers do on a fault. */
+static bool write_faults(uint8_t *p)
+{
+    const pid_t pid = fork();
+    int status;
+
+    if (pid == 0) {
+        dup2(open("/dev/null", O_WRONLY), STDERR_FILENO);
+        *(volatile uint8_t *) p = 0;
+        _exit(0);
+    }
+
+    return pid > 0 && waitpid(pid, &status, 0) == pid
+        && (WIFSIGNALED(status) || WEXITSTATUS(status) != 0);
+}
+#endif
+
+static void test_arena_guard(void)
+{
+#if defined(ARENA_GUARD) && defined(__unix__) && defined(HAVE_STDALIGN_H)
+    const size_t sizes[] = { 100, 3 * page_size() };
+    Arena *arena = arena_new(nullptr, sizes[0]);
+
+    TEST_ASSERT(arena);
+
+    for (size_t i = 0; i < 2; ++i) {
+        if (i != 0) {
+            arena = arena_resize(arena, nullptr, sizes[i]);
+            TEST_ASSERT(arena);
+        }
+
+        /* Debug builds poison the bytes that are not handed out. */
+        uint8_t *const buf = arena_alloc(arena, 1, sizes[i]);
+        const size_t slack = round_up(sizes[i], alignof (max_align_t)) 
+            - sizes[i];
+
+        TEST_ASSERT(buf);
+        TEST_CHECK(is_aligned(buf, alignof (max_align_t)));
+        TEST_CHECK(!write_faults(buf) && !write_faults(buf + sizes[i] - 1));
+        TEST_CHECK(write_faults(buf + sizes[i] + slack));
+
+        /* The leading guard page catches underruns past the start of the page
+         * the buffer starts in. */
+        uint8_t *const page = buf - ((uintptr_t) buf & (page_size() - 1));
+
+        TEST_CHECK(write_faults(page - 1));
+        TEST_MSG("pool %zu", i);
+    }
+
+    arena_destroy(arena);
+#endif
+}
+
+static void test_arena_canary(void)
+{
+#ifdef ARENA_CANARY
+    Arena *const arena = arena_new(nullptr, 1000);
+
+    TEST_ASSERT(arena);
+
+    /* The first block of a pool needs no canary. */
+    uint8_t *const a = arena_alloc(arena, 1, 5);
+    uint8_t *const b = arena_alloc(arena, 1, 5);
+
+    TEST_ASSERT(a && b);
+    TEST_CHECK(b == a + 5 + sizeof arena->canary);
+    TEST_CHECK(arena->canary_count == 1);
+
+    /* Nor does the last one, which can grow in place. */
+    TEST_CHECK(arena_realloc(arena, 20));
+    memset(b, 0, 20);
+
+    ArenaStr str = { 0 };
+
+    TEST_CHECK(arena_str_appendf(arena, &str, "%s", "abc"));
+    TEST_CHECK((uint8_t *) str.data == b + 20 + sizeof arena->canary);
+    TEST_CHECK(arena_str_appendf(arena, &str, "%s", "def"));
+    TEST_CHECK(strcmp(str.data, "abcdef") == 0);
+    TEST_CHECK(arena->canary_count == 2);
+    TEST_CHECK(arena_check(arena));
+
+    /* Off by one. */
+    memset(a, 0, 6);
+    TEST_CHECK(!arena_check(arena));
+    memcpy(a + 5, &arena->canary, sizeof arena->canary);
+    TEST_CHECK(arena_check(arena));
+
+    b[20] = 0;
+    TEST_CHECK(!arena_check(arena));
+    memcpy(b + 20, &arena->canary, sizeof arena->canary);
+
+    /* Blocks at the top have one below them, from the first one on. */
+    uint8_t *const t = arena_alloc_top(arena, 1, 10);
+    uint8_t *const u = arena_alloc_top(arena, 1, 10);
+
+    TEST_ASSERT(t && u);
+    TEST_CHECK(t == arena->pools[0]->buf + 990);
+    TEST_CHECK(u == t - sizeof arena->canary - 10);
+    TEST_CHECK(arena->canary_count == 4);
+
+    u[10] = 0;
+    TEST_CHECK(!arena_check(arena));
+    memcpy(u + 10, &arena->canary, sizeof arena->canary);
+    u[-1] = 0;
+    TEST_CHECK(!arena_check(arena));
+    memcpy(u - sizeof arena->canary, &arena->canary, sizeof arena->canary);
+
+    /* Released with their blocks, as the bottom may take their place. */
+    arena_reset_top(arena);
+    TEST_CHECK(arena->canary_count == 2);
+    TEST_CHECK(arena_check(arena));
+
+    arena_reset(arena);
+    TEST_CHECK(arena->canary_count == 0);
+    TEST_CHECK(arena_alloc(arena, 1, 5) == a);
+    arena_destroy(arena);
+#else
+    Arena *const arena = arena_new(nullptr, 100);
+
+    TEST_ASSERT(arena);
+    TEST_CHECK(arena_check(arena));
+    arena_destroy(arena);
+#endif
+}
+
+static void test_arena_used_bytes(void)
+{
+    Arena *arena = arena_new(nullptr, 100);
+
+    TEST_ASSERT(arena);
+    TEST_CHECK(arena_used_bytes(arena) == 0);
+
+    TEST_ASSERT(arena_alloc(arena, 1, 3));
+    TEST_ASSERT(arena_alloc(arena, 4, 8));
+    TEST_CHECK(arena_used_bytes(arena) == arena->pools[0]->offset);
+
+    TEST_CHECK(arena_realloc(arena, 20));
+    TEST_CHECK(arena_used_bytes(arena) == arena->pools[0]->offset);
+    TEST_CHECK(arena_realloc(arena, 4));
+    TEST_CHECK(arena_used_bytes(arena) == arena->pools[0]->offset);
+    TEST_CHECK(arena_realloc(arena, 0));
+    TEST_CHECK(arena_used_bytes(arena) == arena->pools[0]->offset);
+
+    arena = arena_resize(arena, nullptr, 1000);
+    TEST_ASSERT(arena);
+    TEST_ASSERT(arena_alloc(arena, 1, 500));
+    TEST_CHECK(arena_used_bytes(arena) 
+        == arena->pools[0]->offset + arena->pools[1]->offset);
+
+    arena_reset(arena);
+    TEST_CHECK(arena_used_bytes(arena) == 0);
+    TEST_CHECK(arena_allocated_bytes(arena) == 1100);
+    arena_destroy(arena);
+}
+
+static void test_arena_pool_info(void)
+{
+    Arena *arena = arena_new(nullptr, 100);
+    ArenaPoolInfo info = { 0 };
+
+    TEST_ASSERT(arena);
+    TEST_CHECK(arena_pool_count(arena) == 1);
+    TEST_CHECK(arena_efficiency(arena) == 1.0);
+    TEST_CHECK(!arena_pool_info(arena, 1, &info));
+
+    TEST_ASSERT(arena_alloc(arena, 1, 3));
+    TEST_ASSERT(arena_alloc(arena, 8, 8));
+    TEST_CHECK(arena_alloc(arena, 1, 90) == nullptr);
+
+    TEST_ASSERT(arena_pool_info(arena, 0, &info));
+    TEST_CHECK(info.capacity == 100 && info.used == 16 && info.padding == 5);
+    TEST_CHECK(info.abandoned == 0 && info.free == 84);
+
+    arena = arena_resize(arena, nullptr, 1000);
+    TEST_ASSERT(arena);
+    TEST_ASSERT(arena_alloc(arena, 1, 500));
+    TEST_CHECK(arena_pool_count(arena) == 2);
+
+    TEST_ASSERT(arena_pool_info(arena, 0, &info));
+    TEST_CHECK(info.used == 16 && info.padding == 5);
+    TEST_CHECK(info.abandoned == 0 && info.free == 84);
+    TEST_ASSERT(arena_pool_info(arena, 1, &info));
+    TEST_CHECK(info.capacity == 1000 && info.used == 500 && info.padding == 0);
+    TEST_CHECK(info.abandoned == 0 && info.free == 500);
+    TEST_CHECK(arena_efficiency(arena) == 511.0 / 516.0);
+
+    arena_reset(arena);
+    TEST_ASSERT(arena_pool_info(arena, 0, &info));
+    TEST_CHECK(info.used == 0 && info.padding == 0 && info.free == 100);
+    TEST_ASSERT(arena_pool_info(arena, 1, &info));
+    TEST_CHECK(info.abandoned == 0 && info.free == 1000);
+    TEST_CHECK(arena_efficiency(arena) == 1.0);
+    arena_destroy(arena);
+}
+
+static void test_arena_large(void)
+{
+    uint8_t buf[1000];
+    Arena *arena = arena_new(buf, sizeof buf);
+
+    /* Off unless asked for, so that a buffer of the caller's is all there 
+     * is. */
+    TEST_ASSERT(arena);
+    TEST_CHECK(arena_alloc(arena, 1, 1 << 20) == nullptr);
+    TEST_CHECK(arena_pool_capacity(arena) == sizeof buf);
+    arena_destroy(arena);
+
+    arena = arena_new(nullptr, 1000);
+    TEST_ASSERT(arena);
+    TEST_CHECK(arena_alloc(arena, 1, 1 << 20) == nullptr);
+    arena_set_large_threshold(arena, 500);
+
+    /* Fits, so it is bumped from the pool like any other. */
+    TEST_ASSERT(arena_alloc(arena, 1, 600));
+    TEST_CHECK(arena_pool_capacity(arena) == 400);
+
+    /* Does not fit, but is too small for a buffer of its own. */
+    TEST_CHECK(arena_alloc(arena, 1, 450) == nullptr);
+
+    uint8_t *const p = arena_alloc(arena, 4096, 8192);
+
+    TEST_ASSERT(p);
+    TEST_CHECK((uintptr_t) p % 4096 == 0);
+    memset(p, 0xFF, 8192);
+    TEST_CHECK(arena_pool_capacity(arena) == 400);
+    TEST_CHECK(arena_pool_count(arena) == 1);
+    TEST_CHECK(arena_used_bytes(arena) == 600 + 8192);
+    TEST_CHECK(arena_allocated_bytes(arena) == 1000 + 8192 + 4095);
+
+    /* The block is the last allocation, and can only shrink. */
+    TEST_CHECK(!arena_realloc(arena, 8193));
+    TEST_CHECK(arena_realloc(arena, 4096));
+    TEST_CHECK(arena_used_bytes(arena) == 600 + 4096);
+    TEST_CHECK(arena_realloc(arena, 0));
+    TEST_CHECK(arena_used_bytes(arena) == 600);
+    TEST_CHECK(arena_allocated_bytes(arena) == 1000);
+
+    TEST_ASSERT(arena_alloc(arena, 1, 1 << 20));
+    TEST_ASSERT(arena_alloc(arena, 1, 1 << 20));
+
+    /* The smaller allocations that follow still come from the pool. */
+    TEST_ASSERT(arena_alloc(arena, 1, 100));
+    TEST_CHECK(arena_pool_capacity(arena) == 300);
+    TEST_CHECK(arena_realloc(arena, 200));
+
+#ifdef ARENA_STATS
+    ArenaStats stats;
+
+    TEST_ASSERT(arena_stats(arena, &stats));
+    TEST_CHECK(stats.allocs == 5 && stats.large_allocs == 3);
+#endif
+
+    arena_reset(arena);
+    TEST_CHECK(arena_allocated_bytes(arena) == 1000);
+    TEST_CHECK(arena_used_bytes(arena) == 0);
+
+    arena_set_large_threshold(arena, SIZE_MAX);
+    TEST_CHECK(arena_alloc(arena, 1, 1 << 20) == nullptr);
+    TEST_CHECK(arena_pool_capacity(arena) == 1000);
+    arena_destroy(arena);
+}
+
+static void test_arena_top(void)
+{
+    Arena *const arena = arena_new(nullptr, 1000);
+
+    TEST_ASSERT(arena);
+
+    const uint8_t *const buf = arena->pools[0]->buf;
+    uint8_t *const result = arena_alloc(arena, 1, 100);
+
+    TEST_ASSERT(result);
+    memset(result, 0x11, 100);
+
+    /* Aligned downwards from the end. */
+    uint8_t *const scratch = arena_alloc_top(arena, 8, 48);
+
+    TEST_ASSERT(scratch);
+    TEST_CHECK(scratch == buf + 952);
+    TEST_ASSERT(arena_alloc_top(arena, 1, 3) == buf + 949);
+    TEST_ASSERT(arena_alloc_top(arena, 16, 16) == buf + 928);
+    memset(scratch, 0x22, 48);
+    TEST_CHECK(arena_pool_capacity(arena) == 828);
+    TEST_CHECK(arena_used_bytes(arena) == 172);
+
+    /* The last allocation from the bottom is still resized in place, up to 
+     * the top. */
+    TEST_CHECK(arena_realloc(arena, 929) == false);
+    TEST_CHECK(arena_realloc(arena, 928));
+    TEST_CHECK(arena_alloc_top(arena, 1, 1) == nullptr);
+    TEST_CHECK(arena_alloc(arena, 1, 1) == nullptr);
+    TEST_CHECK(arena_realloc(arena, 100));
+
+    ArenaPoolInfo info = { 0 };
+
+    TEST_ASSERT(arena_pool_info(arena, 0, &info));
+    TEST_CHECK(info.used == 172 && info.padding == 5 && info.free == 828);
+
+    arena_reset_top(arena);
+    TEST_CHECK(arena_pool_capacity(arena) == 900);
+    TEST_CHECK(arena_used_bytes(arena) == 100);
+#ifdef DEBUG
+    TEST_CHECK(is_filled(buf + 900, 100));
+#endif
+    TEST_CHECK(result[0] == 0x11 && result[99] == 0x11);
+    TEST_CHECK(arena_alloc_top(arena, 1, 900) == result + 100);
+
+    TEST_CHECK(arena_alloc_top(arena, 3, 9) == nullptr);
+    TEST_CHECK(arena_alloc_top(arena, 2, 3) == nullptr);
+
+    arena_reset(arena);
+    TEST_CHECK(arena_pool_capacity(arena) == 1000);
+    TEST_CHECK(arena_alloc_top(arena, 1, 1000) == buf);
+
+    /* Only the pools allocated from at the top are visited. */
+    Arena *const resized = arena_resize(arena, nullptr, 500);
+
+    TEST_ASSERT(resized);
+    TEST_ASSERT(arena_alloc_top(resized, 1, 100));
+    TEST_CHECK(resized->tops == resized->pools[1] 
+        && resized->tops->next_top == resized->pools[0]);
+    arena_reset_top(resized);
+    TEST_CHECK(resized->tops == nullptr && arena_used_bytes(resized) == 0);
+    TEST_CHECK(arena_pool_capacity(resized) == 500);
+    arena_destroy(resized);
+}
+
+static void test_arena_leftover(void)
+{
+    Arena *arena = arena_new(nullptr, 1000);
+    ArenaPoolInfo info = { 0 };
+
+    TEST_ASSERT(arena);
+    TEST_ASSERT(arena_alloc(arena, 1, 900));
+    arena = arena_resize(arena, nullptr, 1000);
+    TEST_ASSERT(arena);
+    TEST_ASSERT(arena_alloc(arena, 1, 950));
+
+    /* The tail of the first pool is free, as it can be allocated from. */
+    TEST_ASSERT(arena_pool_info(arena, 0, &info));
+    TEST_CHECK(info.abandoned == 0 && info.free == 100);
+    TEST_CHECK(arena_efficiency(arena) == 1.0);
+
+    /* Does not fit in the current pool, but in the tail of the first. */
+    const uint8_t *const p = arena_alloc(arena, 1, 80);
+
+    TEST_ASSERT(p);
+    TEST_CHECK(p == arena->pools[0]->buf + 900);
+    TEST_CHECK(arena_pool_capacity(arena) == 50);
+    TEST_ASSERT(arena_pool_info(arena, 0, &info));
+    TEST_CHECK(info.used == 980 && info.abandoned == 20);
+
+    /* And can be resized in place there. */
+    TEST_CHECK(arena_realloc(arena, 100));
+    TEST_CHECK(!arena_realloc(arena, 101));
+    TEST_CHECK(arena_used_bytes(arena) == 2000 - 50);
+    TEST_CHECK(arena_alloc(arena, 1, 60) == nullptr);
+
+#ifdef ARENA_STATS
+    ArenaStats stats;
+
+    TEST_ASSERT(arena_stats(arena, &stats));
+    TEST_CHECK(stats.allocs == 3 && stats.leftover_allocs == 1);
+#endif
+
+    /* A tail that a block at its end was expanded into is filed again. */
+    arena_reset(arena);
+    TEST_ASSERT(arena_alloc(arena, 1, 800));
+    TEST_ASSERT(arena_alloc(arena, 1, 1000));
+    TEST_ASSERT(arena_alloc(arena, 1, 64));
+    TEST_CHECK(arena->leftovers[1] == arena->pools[0]);
+    TEST_CHECK(arena_realloc(arena, 164));
+    TEST_CHECK(arena_alloc(arena, 1, 100) == nullptr);
+    TEST_CHECK(arena->leftovers[1] == nullptr);
+    arena_destroy(arena);
+}
+
+static void test_arena_stats(void)
+{
+    Arena *arena = arena_new(nullptr, 100);
+    ArenaStats stats;
+
+    TEST_ASSERT(arena);
+
+#ifdef ARENA_STATS
+    TEST_CHECK(arena_stats(arena, &stats));
+    TEST_CHECK(stats.allocs == 0 && stats.bytes_in_use == 0);
+
+    TEST_ASSERT(arena_alloc(arena, 1, 1));
+    TEST_ASSERT(arena_alloc(arena, 8, 8));
+    TEST_CHECK(arena_realloc(arena, 16));
+    TEST_CHECK(arena_alloc(arena, 1, 100) == nullptr);
+
+    TEST_CHECK(arena_stats(arena, &stats));
+    TEST_CHECK(stats.allocs == 2 && stats.failures == 1);
+    TEST_CHECK(stats.bytes_requested == 17);
+    TEST_CHECK(stats.padding == (size_t) (arena->pools[0]->offset - 17));
+    TEST_CHECK(stats.bytes_consumed == arena->pools[0]->offset);
+    TEST_CHECK(stats.bytes_in_use == arena->pools[0]->offset);
+
+    const size_t peak = stats.bytes_in_use;
+
+    TEST_CHECK(arena_realloc(arena, 0));
+    arena = arena_resize(arena, nullptr, 100);
+    TEST_ASSERT(arena);
+    arena_reset(arena);
+
+    TEST_CHECK(arena_stats(arena, &stats));
+    TEST_CHECK(stats.pools_added == 1 && stats.resets == 1);
+    TEST_CHECK(stats.bytes_in_use == 0 && stats.peak_bytes_in_use == peak);
+#else
+    TEST_CHECK(!arena_stats(arena, &stats));
+    TEST_CHECK(stats.allocs == 0);
+#endif
+    arena_destroy(arena);
+}
+
+static void test_arena_profile(void)
+{
+    Arena *const arena = arena_new(nullptr, 1000);
+
+    TEST_ASSERT(arena);
+
+    for (int i = 0; i < 3; ++i) {
+        TEST_ASSERT(ARENA_ALLOC(arena, 1, 10));
+    }
+
+    TEST_ASSERT(ARENA_ALLOCARRAY(arena, 4, 10, 4));
+    TEST_ASSERT(arena_alloc_site(arena, 1, 100, "tagged"));
+
+    FILE *const stream = tmpfile();
+
+    TEST_ASSERT(stream);
+
+#ifdef ARENA_PROFILE
+    char line[256];
+
+    TEST_CHECK(arena_profile_dump(arena, stream));
+    rewind(stream);
+
+    /* Largest first. */
+    TEST_CHECK(fgets(line, sizeof line, stream) && strstr(line, "site"));
+    TEST_CHECK(fgets(line, sizeof line, stream) && strstr(line, "tagged")
+        && strstr(line, "100"));
+    TEST_CHECK(fgets(line, sizeof line, stream) && strstr(line, "tests.c:")
+        && strstr(line, " 40 "));
+    TEST_CHECK(fgets(line, sizeof line, stream) && strstr(line, "tests.c:")
+        && strstr(line, " 30 ") && strstr(line, " 3 "));
+    TEST_CHECK(fgets(line, sizeof line, stream) && strstr(line, "total")
+        && strstr(line, " 170 ") && strstr(line, " 5 "));
+#else
+    TEST_CHECK(!arena_profile_dump(arena, stream));
+#endif
+    fclose(stream);
+    arena_destroy(arena);
+}
+
+static void test_arena_registry(void)
+{
+#ifdef ARENA_REGISTRY
+    Arena *a = arena_new_named(nullptr, 100, "parser");
+    Arena *const b = arena_new_named(nullptr, 200, "say \"hi\"");
+    char buf[1024];
+
+    TEST_ASSERT(a && b);
+    TEST_ASSERT(arena_alloc(a, 1, 60));
+    arena_reset(a);
+    TEST_ASSERT(arena_alloc(a, 1, 10));
+
+    /* The registry follows the arena as it moves. */
+    a = arena_resize(a, nullptr, 1000);
+    TEST_ASSERT(a);
+
+    size_t len = arena_registry_dump_buf(buf, sizeof buf, ARENA_DUMP_JSON);
+
+    TEST_ASSERT(len > 0 && len < sizeof buf);
+    TEST_CHECK(strstr(buf, "{\"name\":\"parser\",\"pools\":2,"
+        "\"reserved_bytes\":1100,\"used_bytes\":10,\"peak_used_bytes\":60}"));
+    TEST_CHECK(strstr(buf, "{\"name\":\"say \\\"hi\\\"\",\"pools\":1,"));
+    TEST_MSG("%s", buf);
+
+    len = arena_registry_dump_buf(buf, sizeof buf, ARENA_DUMP_PROMETHEUS);
+    TEST_ASSERT(len > 0 && len < sizeof buf);
+    TEST_CHECK(strstr(buf, "# TYPE arena_used_bytes gauge\n"));
+    TEST_CHECK(strstr(buf, "arena_reserved_bytes{name=\"parser\"} 1100\n"));
+    TEST_CHECK(strstr(buf, "arena_pools{name=\"say \\\"hi\\\"\"} 1\n"));
+    TEST_MSG("%s", buf);
+
+    /* Truncated like snprintf(). */
+    TEST_CHECK(arena_registry_dump_buf(buf, 8, ARENA_DUMP_PROMETHEUS) == len);
+    TEST_CHECK(strlen(buf) == 7);
+    TEST_CHECK(arena_registry_dump_buf(nullptr, 0, ARENA_DUMP_PROMETHEUS) 
+        == len);
+
+    arena_destroy(a);
+    arena_registry_dump_buf(buf, sizeof buf, ARENA_DUMP_JSON);
+    TEST_CHECK(strstr(buf, "parser") == nullptr);
+
+    /* The entry released by `a` is reused. */
+    a = arena_new_named(nullptr, 100, "lexer");
+    TEST_ASSERT(a);
+    arena_registry_dump_buf(buf, sizeof buf, ARENA_DUMP_JSON);
+    TEST_CHECK(strstr(buf, "lexer") && strstr(buf, "say"));
+
+    FILE *const stream = tmpfile();
+
+    TEST_ASSERT(stream);
+    TEST_CHECK(arena_registry_dump(stream, ARENA_DUMP_JSON));
+    TEST_CHECK(ftell(stream) == (long) strlen(buf));
+    fclose(stream);
+
+    arena_destroy(a);
+    arena_destroy(b);
+    TEST_CHECK(arena_registry_dump_buf(buf, sizeof buf, ARENA_DUMP_JSON) 
+        == strlen("{\"arenas\":[]}\n"));
+#else
+    char buf[8];
+
+    TEST_CHECK(arena_registry_dump_buf(buf, sizeof buf, ARENA_DUMP_JSON) == 0);
+    TEST_CHECK(!arena_registry_dump(stderr, ARENA_DUMP_JSON));
+#endif
+}
+
+static void test_arena_capacity(void)
+{
+    const char *const path = "tests_capacity.txt";
+
+#ifdef ARENA_REGISTRY
+    Arena *arena = arena_new_named(nullptr, 1000, "learned");
+
+    TEST_ASSERT(arena);
+    TEST_ASSERT(arena_alloc(arena, 1, 900));
+    arena = arena_resize(arena, nullptr, 10000);
+    TEST_ASSERT(arena);
+    TEST_ASSERT(arena_alloc(arena, 1, 4000));
+
+    /* Large blocks do not live in the pools, and are not recorded. */
+    arena_set_large_threshold(arena, 8192);
+    TEST_ASSERT(arena_alloc(arena, 1, 1 << 20));
+    arena_destroy(arena);
+
+    /* Live arenas are recorded when saving. */
+    Arena *const live = arena_new_named(nullptr, 100, "live");
+
+    TEST_ASSERT(live);
+    TEST_ASSERT(arena_alloc(live, 1, 64));
+    TEST_ASSERT(arena_capacity_save(path));
+
+    FILE *stream = fopen(path, "r");
+    char text[256] = { 0 };
+
+    TEST_ASSERT(stream);
+    TEST_CHECK(fread(text, 1, sizeof text - 1, stream) > 0);
+    fclose(stream);
+    TEST_CHECK(strstr(text, "\n4900 learned\n") != nullptr);
+    TEST_CHECK(strstr(text, "\n64 live\n") != nullptr);
+    TEST_MSG("%s", text);
+
+    stream = fopen(path, "w");
+    TEST_ASSERT(stream);
+    fputs("# Comment.\n400000 learned\n10 with spaces in it\n", stream);
+    fclose(stream);
+    TEST_CHECK(arena_capacity_load(path));
+
+    /* With room for a run that peaks higher. */
+    arena = arena_new_named(nullptr, 0, "learned");
+    TEST_ASSERT(arena);
+    TEST_CHECK(arena_allocated_bytes(arena) == 600000);
+    TEST_CHECK(arena_pool_count(arena) == 1);
+    TEST_ASSERT(arena_alloc(arena, 1, 500000));
+    arena_destroy(arena);
+
+    /* Never below the default. */
+    arena = arena_new_named(nullptr, 0, "with spaces in it");
+    TEST_ASSERT(arena);
+    TEST_CHECK(arena_allocated_bytes(arena) == 256 * 1024);
+    arena_destroy(arena);
+
+    /* A capacity, or a name without one, is not overridden. */
+    arena = arena_new_named(nullptr, 100, "learned");
+    TEST_ASSERT(arena);
+    TEST_CHECK(arena_allocated_bytes(arena) == 100);
+    arena_destroy(arena);
+    arena = arena_new_named(nullptr, 0, "unknown");
+    TEST_ASSERT(arena);
+    TEST_CHECK(arena_allocated_bytes(arena) == 256 * 1024);
+    arena_destroy(arena);
+    arena_destroy(live);
+
+    stream = fopen(path, "w");
+    TEST_ASSERT(stream);
+    fputs("learned 4900\n", stream);
+    fclose(stream);
+    TEST_CHECK(!arena_capacity_load(path));
+    TEST_CHECK(remove(path) == 0);
+    TEST_CHECK(!arena_capacity_load(path));
+#else
+    TEST_CHECK(!arena_capacity_load(path));
+    TEST_CHECK(!arena_capacity_save(path));
+    TEST_CHECK(!arena_capacity_save_at_exit(path));
+#endif
+}
+
+static void test_arena_trace(void)
+{
+    FILE *const stream = tmpfile();
+    ArenaTraceEvent e;
+
+    TEST_ASSERT(stream);
+
+#ifdef ARENA_TRACE
+    TEST_ASSERT(arena_trace_start(stream));
+    TEST_CHECK(!arena_trace_start(stream));
+
+    Arena *arena = arena_new(nullptr, 100);
+
+    TEST_ASSERT(arena);
+    TEST_CHECK(arena_new(stream, 0) == nullptr);
+    arena_set_large_threshold(arena, 4096);
+    TEST_ASSERT(arena_alloc(arena, 4, 8));
+    TEST_ASSERT(arena_allocarray(arena, 8, 3, 8));
+    TEST_CHECK(!arena_realloc(arena, 1000));
+    arena = arena_resize(arena, nullptr, 300);
+    TEST_ASSERT(arena);
+    arena_reset(arena);
+    TEST_CHECK(arena_reset_consolidate(arena, 1.5));
+    arena_destroy(arena);
+    arena_trace_stop();
+
+    /* Not recorded once stopped. */
+    arena = arena_new(nullptr, 100);
+    TEST_ASSERT(arena);
+    arena_destroy(arena);
+
+    rewind(stream);
+    TEST_ASSERT(arena_trace_read_header(stream));
+
+    const struct {
+        ArenaTraceOp op;
+        bool ok;
+        size_t args[3];
+    } expected[] = {
+        { ARENA_TRACE_NEW, true, { 100, 0, 0 } },
+        { ARENA_TRACE_NEW, false, { 0, 1, 0 } },
+        { ARENA_TRACE_SET_LARGE_THRESHOLD, true, { 4096, 0, 0 } },
+        { ARENA_TRACE_ALLOC, true, { 4, 8, 0 } },
+        { ARENA_TRACE_ALLOCARRAY, true, { 8, 3, 8 } },
+        { ARENA_TRACE_REALLOC, false, { 1000, 0, 0 } },
+        { ARENA_TRACE_RESIZE, true, { 300, 0, 0 } },
+        { ARENA_TRACE_RESET, true, { 0, 0, 0 } },
+        { ARENA_TRACE_RESET_CONSOLIDATE, true, { 1536, 0, 0 } },
+        { ARENA_TRACE_DESTROY, true, { 0, 0, 0 } },
+    };
+    uint64_t id = 0;
+    uint64_t ns = 0;
+
+    for (size_t i = 0; i < sizeof expected / sizeof expected[0]; ++i) {
+        TEST_ASSERT(arena_trace_read(stream, &e) == 1);
+        TEST_CHECK(e.op == expected[i].op && e.ok == expected[i].ok);
+        TEST_CHECK(memcmp(e.args, expected[i].args, sizeof e.args) == 0);
+        TEST_CHECK(e.ns >= ns);
+        TEST_MSG("event %zu", i);
+        ns = e.ns;
+
+        if (i == 0) {
+            id = e.arena;
+            TEST_CHECK(id != 0);
+        } else {
+            TEST_CHECK(e.arena == (i == 1 ? 0 : id));
+        }
+    }
+
+    TEST_CHECK(arena_trace_read(stream, &e) == 0);
+#else
+    TEST_CHECK(!arena_trace_start(stream));
+#endif
+    fclose(stream);
+
+    /* A truncated event is reported. */
+    const unsigned char truncated[] = { ARENA_TRACE_ALLOC, 0x80 };
+    FILE *const bad = tmpfile();
+
+    TEST_ASSERT(bad);
+    fwrite(truncated, 1, sizeof truncated, bad);
+    rewind(bad);
+    TEST_CHECK(arena_trace_read(bad, &e) == -1);
+    TEST_CHECK(!arena_trace_read_header(bad));
+    fclose(bad);
+}
+
+static void test_arena_vec(void)
+{
+    Arena *const arena = arena_new(nullptr, 2000);
+
+    TEST_ASSERT(arena);
+
+    ArenaVec vec;
+
+    arena_vec_init(&vec, sizeof (uint32_t), sizeof (uint32_t));
+    TEST_CHECK(vec.len == 0 && vec.cap == 0 && vec.data == nullptr);
+    TEST_CHECK(arena_vec_at(&vec, 0) == nullptr);
+
+    uint32_t x = 0;
+
+    TEST_ASSERT(arena_vec_push(arena, &vec, &x));
+    const void *const data = vec.data;
+
+    /* The array is the last allocation, so it grows in place. */
+    for (x = 1; x < 100; ++x) {
+        TEST_ASSERT(arena_vec_push(arena, &vec, &x));
+    }
+
+    TEST_CHECK(vec.data == data && vec.len == 100 && vec.cap >= 100);
+
+    /* Once something else has been allocated, the array is copied. */
+    TEST_ASSERT(arena_alloc(arena, 1, 1));
+    TEST_CHECK(arena_vec_reserve(arena, &vec, vec.cap + 1));
+    TEST_CHECK(vec.data != data && vec.len == 100);
+
+    for (uint32_t i = 0; i < 100; ++i) {
+        const uint32_t *const elem = arena_vec_at(&vec, i);
+
+        TEST_CHECK(elem && *elem == i);
+    }
+
+    TEST_CHECK(arena_vec_at(&vec, 100) == nullptr);
+
+    /* A full pool fails without touching the array. */
+    const size_t cap = vec.cap;
+
+    TEST_CHECK(!arena_vec_reserve(arena, &vec, 1000));
+    TEST_CHECK(vec.cap == cap && vec.len == 100);
+    arena_destroy(arena);
+}
+
+static void test_arena_str(void)
+{
+    Arena *const arena = arena_new(nullptr, 100);
+
+    TEST_ASSERT(arena);
+
+    ArenaStr str = { 0 };
+
+    TEST_CHECK(arena_str_append(arena, &str, "foo", 3));
+    const char *const data = str.data;
+
+    TEST_CHECK(arena_str_appendf(arena, &str, "-%d-%s", 42, "bar"));
+    TEST_CHECK(arena_str_append(arena, &str, "baz", 3));
+
+    /* The string is the last allocation, so it is appended to in place. */
+    TEST_CHECK(str.data == data && str.len == 13);
+    TEST_CHECK(strcmp(str.data, "foo-42-barbaz") == 0);
+    TEST_CHECK(arena_pool_capacity(arena) == 100 - 14);
+
+    /* Once something else has been allocated, the string is copied. */
+    TEST_ASSERT(arena_alloc(arena, 1, 1));
+    TEST_CHECK(arena_str_appendf(arena, &str, "%c", '!'));
+    TEST_CHECK(str.data != data && strcmp(str.data, "foo-42-barbaz!") == 0);
+#ifndef ARENA_CANARY
+    /* Formatted straight after the copy, which takes no more room. */
+    TEST_CHECK(arena_pool_capacity(arena) == 100 - 14 - 1 - 15);
+#endif
+
+    /* Failure leaves the string unchanged. */
+    TEST_CHECK(!arena_str_appendf(arena, &str, "%100s", ""));
+    TEST_CHECK(strcmp(str.data, "foo-42-barbaz!") == 0);
+    TEST_ASSERT(arena_alloc(arena, 1, 1));
+    TEST_CHECK(!arena_str_appendf(arena, &str, "%100s", ""));
+    TEST_CHECK(strcmp(str.data, "foo-42-barbaz!") == 0);
+#ifndef ARENA_CANARY
+    TEST_CHECK(arena_pool_capacity(arena) == 100 - 14 - 1 - 15 - 1);
+#endif
+    arena_destroy(arena);
+}
+
+static void test_arena_sprintf(void)
+{
+    Arena *arena = arena_new(nullptr, 16);
+
+    TEST_ASSERT(arena);
+
+    const char *const s = arena_sprintf(arena, "%d+%d", 2, 3);
+
+    TEST_CHECK(s && strcmp(s, "2+3") == 0);
+    TEST_CHECK(arena_pool_capacity(arena) == 12);
+    TEST_CHECK(arena_sprintf(arena, "%s", "this does not fit") == nullptr);
+    TEST_CHECK(arena_pool_capacity(arena) == 12);
+
+    /* The output goes to the next pool if it does not fit in the current 
+     * one. */
+    arena = arena_resize(arena, nullptr, 100);
+    TEST_ASSERT(arena);
+    arena_reset(arena);
+    TEST_ASSERT(arena_alloc(arena, 1, 10));
+
+    const char *const t = arena_sprintf(arena, "%s", "this does not fit");
+
+    TEST_CHECK(t && strcmp(t, "this does not fit") == 0);
+    TEST_CHECK(arena->current == 2);
+    arena_destroy(arena);
+}
+
+static void test_arena_deque(void)
+{
+    Arena *const arena = arena_new(nullptr, 10000);
+
+    TEST_ASSERT(arena);
+
+    ArenaDeque deque;
+
+    arena_deque_init(&deque, sizeof (uint32_t), sizeof (uint32_t), 5);
+    TEST_CHECK(deque.chunk_len == 8);
+    TEST_CHECK(arena_deque_at(&deque, 0) == nullptr);
+    TEST_CHECK(arena_deque_pop_back(&deque) == nullptr);
+
+    uint32_t x = 100;
+    const uint32_t *const first = arena_deque_push_back(arena, &deque, &x);
+
+    TEST_ASSERT(first);
+
+    for (x = 101; x < 200; ++x) {
+        TEST_ASSERT(arena_deque_push_back(arena, &deque, &x));
+    }
+
+    for (x = 99; x != UINT32_MAX; --x) {
+        TEST_ASSERT(arena_deque_push_front(arena, &deque, &x));
+    }
+
+    /* Elements never move. */
+    TEST_CHECK(*first == 100 && arena_deque_at(&deque, 100) == first);
+    TEST_CHECK(deque.len == 200);
+
+    for (uint32_t i = 0; i < 200; ++i) {
+        const uint32_t *const elem = arena_deque_at(&deque, i);
+
+        TEST_CHECK(elem && *elem == i);
+    }
+
+    TEST_CHECK(arena_deque_at(&deque, 200) == nullptr);
+
+    /* The chunks cover all the elements, in order. */
+    uint32_t expected = 0;
+    size_t len;
+    const uint32_t *chunk;
+
+    for (size_t i = 0; (chunk = arena_deque_chunk(&deque, i, &len)); ++i) {
+        TEST_CHECK(len != 0 && len <= deque.chunk_len);
+
+        for (size_t j = 0; j < len; ++j) {
+            TEST_CHECK(chunk[j] == expected++);
+        }
+    }
+
+    TEST_CHECK(expected == 200 && len == 0);
+
+    const uint32_t *const back = arena_deque_pop_back(&deque);
+    const uint32_t *const front = arena_deque_pop_front(&deque);
+
+    TEST_CHECK(back && *back == 199 && front && *front == 0);
+    TEST_CHECK(deque.len == 198);
+
+    const uint32_t *const elem = arena_deque_at(&deque, 0);
+
+    TEST_CHECK(elem && *elem == 1);
+    arena_destroy(arena);
+}
+
+static void test_arena_intern(void)
+{
+    Arena *const arena = arena_new(nullptr, 0);
+
+    TEST_ASSERT(arena);
+
+    ArenaIntern *const table = arena_intern_new(arena, 0);
+
+    TEST_ASSERT(table);
+
+    const char *const foo = arena_intern(arena, table, "foo", 3);
+    const char *const bar = arena_intern(arena, table, "foobar" + 3, 3);
+
+    TEST_CHECK(foo && strcmp(foo, "foo") == 0);
+    TEST_CHECK(bar && strcmp(bar, "bar") == 0);
+    TEST_CHECK(arena_intern(arena, table, "foo!", 3) == foo);
+    TEST_CHECK(arena_intern_find(table, "bar", 3) == bar);
+    TEST_CHECK(arena_intern_find(table, "baz", 3) == nullptr);
+    TEST_CHECK(arena_intern(arena, table, "", 0) != nullptr);
+    TEST_CHECK(arena_intern_count(table) == 3);
+
+    /* Strings stay put as the table grows. */
+    char buf[32];
+
+    for (int i = 0; i < 1000; ++i) {
+        const int len = snprintf(buf, sizeof buf, "key%d", i);
+
+        TEST_ASSERT(arena_intern(arena, table, buf, (size_t) len));
+    }
+
+    TEST_CHECK(arena_intern_count(table) == 1003);
+    TEST_CHECK(arena_intern(arena, table, "foo", 3) == foo);
+    TEST_CHECK(arena_intern_find(table, "bar", 3) == bar);
+
+    for (int i = 0; i < 1000; ++i) {
+        const int len = snprintf(buf, sizeof buf, "key%d", i);
+        const char *const s = arena_intern_find(table, buf, (size_t) len);
+
+        TEST_CHECK(s && strcmp(s, buf) == 0);
+    }
+
+    arena_destroy(arena);
+}
+
+static void test_arena_map(void)
+{
+    Arena *const arena = arena_new(nullptr, 0);
+
+    TEST_ASSERT(arena);
+
+    TEST_CHECK(arena_map_new(arena, 3, 8, 8, 0) == nullptr);
+    TEST_CHECK(arena_map_new(arena, 8, 0, 8, 0) == nullptr);
+
+    ArenaMap *const map = 
+        arena_map_new(arena, sizeof (uint64_t), sizeof (uint64_t), 
+                      sizeof (uint64_t), 0);
+
+    TEST_ASSERT(map);
+
+    /* The map is the last allocation, so it grows in place. */
+    const uint8_t *const slots = map->slots;
+
+    for (uint64_t k = 0; k < 1000; ++k) {
+        const uint64_t v = k * k;
+
+        TEST_ASSERT(arena_map_put(arena, map, &k, &v));
+    }
+
+    TEST_CHECK(arena_map_count(map) == 1000);
+    TEST_CHECK(map->slots == slots && map->cap >= 1024);
+
+    for (uint64_t k = 0; k < 1000; ++k) {
+        const uint64_t *const v = arena_map_get(map, &k);
+
+        TEST_CHECK(v && *v == k * k);
+    }
+
+    /* Existing keys are updated. */
+    const uint64_t key = 10;
+    const uint64_t value = 7;
+    uint64_t *const v = arena_map_put(arena, map, &key, &value);
+
+    TEST_CHECK(v && *v == 7 && arena_map_count(map) == 1000);
+
+    /* Once something else has been allocated, the map is rehashed into a new 
+     * block. */
+    TEST_ASSERT(arena_alloc(arena, 1, 1));
+
+    for (uint64_t k = 1000; k < 2000; ++k) {
+        TEST_ASSERT(arena_map_put(arena, map, &k, &k));
+    }
+
+    TEST_CHECK(map->slots != slots);
+
+    for (uint64_t k = 0; k < 2000; k += 2) {
+        TEST_CHECK(arena_map_remove(map, &k));
+    }
+
+    TEST_CHECK(!arena_map_remove(map, &key));
+    TEST_CHECK(arena_map_count(map) == 1000);
+    TEST_CHECK(arena_map_get(map, &key) == nullptr);
+
+    size_t iter = 0;
+    size_t n = 0;
+    void *k;
+
+    while (arena_map_next(map, &iter, &k, nullptr)) {
+        TEST_CHECK(*(const uint64_t *) k % 2 == 1);
+        ++n;
+    }
+
+    TEST_CHECK(n == 1000);
+    arena_destroy(arena);
+}
+
 /* *INDENT-OFF* */
 TEST_LIST = {
     { "arena_new", test_arena_new },
@@ -239,11 +1569,33 @@ TEST_LIST = {
     { "arena_reset", test_arena_reset },
     { "arena_alloc", test_arena_alloc },
     { "arena_resize", test_arena_resize },
+    { "arena_reset_consolidate", test_arena_reset_consolidate },
+    { "arena_new_with", test_arena_new_with },
+    { "arena_new_child", test_arena_new_child },
     { "arena_allocarray", test_arena_allocarray },
     { "arena_realloc", test_arena_realloc },
     { "arena_pool_capacity", test_arena_pool_capacity},
     { "arena_allocated_bytes", test_arena_allocated_bytes },
     { "arena_allocated_bytes_including_metadata", test_arena_allocated_bytes_including_metadata },
+    { "arena_debug", test_arena_debug },
+    { "arena_guard", test_arena_guard },
+    { "arena_canary", test_arena_canary },
+    { "arena_used_bytes", test_arena_used_bytes },
+    { "arena_pool_info", test_arena_pool_info },
+    { "arena_large", test_arena_large },
+    { "arena_top", test_arena_top },
+    { "arena_leftover", test_arena_leftover },
+    { "arena_stats", test_arena_stats },
+    { "arena_profile", test_arena_profile },
+    { "arena_registry", test_arena_registry },
+    { "arena_capacity", test_arena_capacity },
+    { "arena_trace", test_arena_trace },
+    { "arena_vec", test_arena_vec },
+    { "arena_str", test_arena_str },
+    { "arena_sprintf", test_arena_sprintf },
+    { "arena_deque", test_arena_deque },
+    { "arena_intern", test_arena_intern },
+    { "arena_map", test_arena_map },
     { nullptr, nullptr }
 };
 /* *INDENT-ON* */